@@ -0,0 +1,58 @@
+#ifndef ACTIVATION_HPP
+#define ACTIVATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <regex>
+#include <string>
+
+// Activation code of a layer from its npz name ("a<index>_<activation>_<index>")
+inline unsigned int activation_code(const std::string &name)
+{
+    std::regex re("a\\d+\\_([a-z]+)\\_\\d+");
+    std::smatch match;
+    std::regex_search(name, match, re);
+    std::string result = match.str(1);
+    unsigned int activation = 0;
+    if (result == "sigmoid")
+    {
+        activation = 1;
+    }
+    else if (result == "relu")
+    {
+        activation = 2;
+    }
+    else if (result == "softmax")
+    {
+        activation = 3;
+    }
+    return activation;
+}
+
+// Apply the activation of an NPU instruction (0 linear, 1 sigmoid, 2 relu, 3 softmax)
+inline void activate(unsigned int activation, float *values, size_t length)
+{
+    if (activation == 1)
+    {
+        for (size_t i = 0; i < length; i++)
+            values[i] = 1.0f / (1.0f + std::exp(-values[i]));
+    }
+    else if (activation == 2)
+    {
+        for (size_t i = 0; i < length; i++)
+            values[i] = std::max(values[i], 0.0f);
+    }
+    else if (activation == 3)
+    {
+        float max = *std::max_element(values, values + length), sum = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            values[i] = std::exp(values[i] - max);
+            sum += values[i];
+        }
+        for (size_t i = 0; i < length; i++)
+            values[i] /= sum;
+    }
+}
+
+#endif
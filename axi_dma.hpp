@@ -0,0 +1,96 @@
+#ifndef AXI_DMA_HPP
+#define AXI_DMA_HPP
+
+#include <chrono>
+#include "mmio.hpp"
+
+// Register-level access to one AXI DMA (simple mode) through relaxed MMIO. The
+// channel is armed with a single control write and the only barrier is issued
+// right before the length register, which starts the transfer.
+class AxiDmaChannel
+{
+public:
+    // Register offsets (Xilinx PG021)
+    static const size_t MM2S_DMACR = 0x00, MM2S_DMASR = 0x04, MM2S_SA = 0x18, MM2S_LENGTH = 0x28;
+    static const size_t S2MM_DMACR = 0x30, S2MM_DMASR = 0x34, S2MM_DA = 0x48, S2MM_LENGTH = 0x58;
+
+    // DMACR bits
+    static const uint32_t RUN = 1 << 0, RESET = 1 << 2, IOC_IRQ = 1 << 12, ERR_IRQ = 1 << 14;
+
+    // DMASR bits, IOC_IRQ and ERR_IRQ at the same positions
+    static const uint32_t HALTED = 1 << 0, IDLE = 1 << 1, INTERNAL_ERROR = 1 << 4, SLAVE_ERROR = 1 << 5, DECODE_ERROR = 1 << 6;
+
+    // Whether a status register value reports a failed transfer; the channel
+    // stays halted until it is reset
+    static bool isError(unsigned long status)
+    {
+        return status & (INTERNAL_ERROR | SLAVE_ERROR | DECODE_ERROR | ERR_IRQ);
+    }
+
+    AxiDmaChannel(unsigned long base, bool s2mm) : registers(base, 0x1000), s2mm(s2mm) {}
+
+    bool isMapped() const
+    {
+        return registers.isMapped();
+    }
+
+    // Same end state as reset(), halt(), setInterrupt(true, true, 0), ready().
+    // Returns false, the channel left in reset, if the reset does not complete
+    // within `timeout` (a wedged engine).
+    bool arm(std::chrono::microseconds timeout = std::chrono::microseconds(10000))
+    {
+        registers.write32(MM2S_DMACR, RESET);
+        std::chrono::steady_clock::time_point deadline;
+        for (size_t polls = 0; registers.read32(MM2S_DMACR) & RESET; polls++)
+        {
+            // The clock is only read once the reset did not complete at once
+            if (polls == 0)
+                deadline = std::chrono::steady_clock::now() + timeout;
+            else if (std::chrono::steady_clock::now() > deadline)
+                return false;
+        }
+        registers.write32(MM2S_DMACR, RUN | IOC_IRQ | ERR_IRQ);
+        if (s2mm)
+            registers.write32(S2MM_DMACR, RUN | IOC_IRQ | ERR_IRQ);
+        return true;
+    }
+
+    void setSourceAddress(uint32_t address)
+    {
+        registers.write32(MM2S_SA, address);
+    }
+
+    // Doorbell: publish buffer fills and register setup, then start MM2S
+    void startSource(uint32_t length)
+    {
+        io_barrier();
+        registers.write32(MM2S_LENGTH, length);
+    }
+
+    void setDestinationAddress(uint32_t address)
+    {
+        registers.write32(S2MM_DA, address);
+    }
+
+    void startDestination(uint32_t length)
+    {
+        io_barrier();
+        registers.write32(S2MM_LENGTH, length);
+    }
+
+    unsigned long getMM2SStatus() const
+    {
+        return registers.read32(MM2S_DMASR);
+    }
+
+    unsigned long getS2MMStatus() const
+    {
+        return registers.read32(S2MM_DMASR);
+    }
+
+private:
+    MmioRegion registers;
+    bool s2mm;
+};
+
+#endif
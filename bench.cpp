@@ -0,0 +1,214 @@
+#include <benchmark/benchmark.h> // https://github.com/google/benchmark
+#include <cnpy.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cstdio>
+#include <random>
+#include <string>
+#include "activation.hpp"
+#include "npz_reader.hpp"
+#include "packing.hpp"
+#include "scoring.hpp"
+#include "stream_copy.hpp"
+
+// Host-side hot paths of npu_tester run against plain memory instead of the DMA
+// windows, so regressions show up before reaching the board (make bench)
+
+static std::vector<float> random_floats(size_t count)
+{
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> value(-1, 1);
+    std::vector<float> values(count);
+    for (float &v : values)
+        v = value(generator);
+    return values;
+}
+
+static cnpy::NpyArray random_layer(size_t inputs, size_t outputs)
+{
+    cnpy::NpyArray layer({inputs, outputs}, sizeof(float), false);
+    std::vector<float> weights = random_floats(inputs * outputs);
+    std::copy(weights.begin(), weights.end(), layer.data<float>());
+    return layer;
+}
+
+// Layer of inputs x outputs tiled for a core count
+static void BM_TileWeights(benchmark::State &state)
+{
+    cnpy::NpyArray layer = random_layer(state.range(0), state.range(1));
+    std::vector<float> packed;
+    std::vector<uint64_t> hashes;
+    for (auto _ : state)
+    {
+        packed.clear();
+        hashes.clear();
+        tile_weights(layer, state.range(2), packed, hashes);
+        benchmark::DoNotOptimize(packed.data());
+    }
+    state.SetBytesProcessed(state.iterations() * layer.num_bytes());
+}
+BENCHMARK(BM_TileWeights)->ArgsProduct({{64, 784}, {10, 128, 1000}, {1, 4, 16, 64}});
+
+// Input row staged one float at a time, as through writeSourceFloat()
+static void BM_StagePerFloat(benchmark::State &state)
+{
+    std::vector<float> input = random_floats(state.range(0));
+    std::vector<float> window(65536);
+    for (auto _ : state)
+    {
+        volatile float *destination = window.data();
+        for (size_t i = 0; i < input.size(); i++)
+            destination[i] = input[i];
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * input.size() * sizeof(float));
+}
+BENCHMARK(BM_StagePerFloat)->RangeMultiplier(4)->Range(16, 16384);
+
+// Input row staged with stream_copy() at a byte offset in the window
+static void BM_StageStreamCopy(benchmark::State &state)
+{
+    std::vector<float> input = random_floats(state.range(0));
+    std::vector<float> window(65536 + 16);
+    for (auto _ : state)
+    {
+        stream_copy((uint8_t *)window.data() + state.range(1), input.data(), input.size() * sizeof(float));
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * input.size() * sizeof(float));
+}
+BENCHMARK(BM_StageStreamCopy)->ArgsProduct({benchmark::CreateRange(16, 16384, 4), {0, 4}});
+
+static void BM_Argmax(benchmark::State &state)
+{
+    std::vector<float> outputs = random_floats(state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(argmax(outputs));
+    state.SetItemsProcessed(state.iterations() * outputs.size());
+}
+BENCHMARK(BM_Argmax)->Arg(10)->Arg(100)->Arg(1000);
+
+static void BM_TopK(benchmark::State &state)
+{
+    std::vector<float> outputs = random_floats(state.range(0));
+    std::vector<size_t> indices;
+    for (auto _ : state)
+    {
+        top_k(outputs.data(), outputs.size(), state.range(1), indices);
+        benchmark::DoNotOptimize(indices.data());
+    }
+    state.SetItemsProcessed(state.iterations() * outputs.size());
+}
+BENCHMARK(BM_TopK)->ArgsProduct({{10, 100, 1000}, {1, 5}});
+
+// Instruction words of a model from its layer names and shapes
+static void BM_EncodeInstructions(benchmark::State &state)
+{
+    std::vector<std::string> names;
+    const char *activations[] = {"relu", "sigmoid", "linear", "softmax"};
+    for (int64_t l = 0; l < state.range(0); l++)
+        names.push_back("a" + std::to_string(l) + "_" + activations[l % 4] + "_" + std::to_string(l));
+    std::vector<uint64_t> instructions(names.size());
+    for (auto _ : state)
+    {
+        for (size_t l = 0; l < names.size(); l++)
+            instructions[l] = encode_instruction(128, 64, activation_code(names[l]));
+        benchmark::DoNotOptimize(instructions.data());
+    }
+    state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK(BM_EncodeInstructions)->Arg(4)->Arg(16);
+
+// Deflated npz of `arrays` arrays of `floats` floats, laid out like NumPy's
+// savez_compressed output: local headers carrying the sizes, then the central
+// directory and its end record, which cnpy::npz_load needs to stop. Returns its path.
+static std::string write_npz(size_t arrays, size_t floats)
+{
+    std::string path = "/tmp/npu_bench_" + std::to_string(getpid()) + ".npz";
+    FILE *file = fopen(path.c_str(), "wb");
+    std::vector<float> values = random_floats(floats);
+    std::string directory;
+
+    for (size_t a = 0; a < arrays; a++)
+    {
+        std::string dictionary = "{'descr': '<f4', 'fortran_order': False, 'shape': (" + std::to_string(floats) + ",), }";
+        dictionary.append(63 - (10 + dictionary.size()) % 64, ' ');
+        dictionary += '\n';
+        std::string npy = std::string("\x93NUMPY\x01\x00", 8);
+        npy += (char)(dictionary.size() & 0xFF);
+        npy += (char)(dictionary.size() >> 8);
+        npy += dictionary;
+        npy.append((const char *)values.data(), floats * sizeof(float));
+
+        std::vector<uint8_t> compressed(compressBound(npy.size()));
+        z_stream z = {};
+        deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        z.next_in = (Bytef *)npy.data();
+        z.avail_in = npy.size();
+        z.next_out = compressed.data();
+        z.avail_out = compressed.size();
+        deflate(&z, Z_FINISH);
+        deflateEnd(&z);
+
+        std::string name = "array" + std::to_string(a) + ".npy";
+        uint32_t signature = 0x04034b50;
+        uint8_t header[30] = {};
+        memcpy(header, &signature, 4);
+        header[4] = 20;
+        header[8] = 8;
+        uint32_t crc = crc32(0, (const Bytef *)npy.data(), npy.size()), sizes[] = {(uint32_t)z.total_out, (uint32_t)npy.size()};
+        memcpy(header + 14, &crc, 4);
+        memcpy(header + 18, sizes, 8);
+        header[26] = name.size();
+
+        // Central directory entry: the local header fields at their own offsets
+        uint32_t central_signature = 0x02014b50, offset = ftell(file);
+        uint8_t central[46] = {};
+        memcpy(central, &central_signature, 4);
+        central[4] = 20;
+        memcpy(central + 6, header + 4, 26);
+        memcpy(central + 42, &offset, 4);
+        directory.append((const char *)central, 46);
+        directory += name;
+
+        fwrite(header, 1, 30, file);
+        fwrite(name.data(), 1, name.size(), file);
+        fwrite(compressed.data(), 1, z.total_out, file);
+    }
+
+    uint32_t end_signature = 0x06054b50, directory_size = directory.size(), directory_offset = ftell(file);
+    uint16_t entries = arrays;
+    uint8_t end[22] = {};
+    memcpy(end, &end_signature, 4);
+    memcpy(end + 8, &entries, 2);
+    memcpy(end + 10, &entries, 2);
+    memcpy(end + 12, &directory_size, 4);
+    memcpy(end + 16, &directory_offset, 4);
+    fwrite(directory.data(), 1, directory.size(), file);
+    fwrite(end, 1, 22, file);
+
+    fclose(file);
+    return path;
+}
+
+static void BM_NpzLoad(benchmark::State &state)
+{
+    std::string path = write_npz(state.range(0), state.range(1));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cnpy::npz_load(path));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * state.range(1) * sizeof(float));
+    remove(path.c_str());
+}
+BENCHMARK(BM_NpzLoad)->Args({2, 1 << 14})->Args({2, 1 << 20})->Unit(benchmark::kMillisecond);
+
+static void BM_NpzRead(benchmark::State &state)
+{
+    std::string path = write_npz(state.range(0), state.range(1));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(npz_read(path));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * state.range(1) * sizeof(float));
+    remove(path.c_str());
+}
+BENCHMARK(BM_NpzRead)->Args({2, 1 << 14})->Args({2, 1 << 20})->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
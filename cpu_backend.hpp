@@ -0,0 +1,103 @@
+#ifndef CPU_BACKEND_HPP
+#define CPU_BACKEND_HPP
+
+#include <cnpy.h>
+#include <algorithm>
+#include <vector>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include "activation.hpp"
+
+// Dot product of two float vectors, NEON or SSE when available
+inline float dot(const float *a, const float *b, size_t length)
+{
+    size_t i = 0;
+    float sum = 0;
+#if defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    for (; i + 8 <= length; i += 8)
+    {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+    float32x2_t pair = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#elif defined(__SSE__)
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    for (; i + 8 <= length; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < length; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+// Host implementation of the dense layers executed by the NPU
+class CpuModel
+{
+public:
+    CpuModel(cnpy::npz_t &layers)
+    {
+        for (cnpy::npz_t::iterator it = layers.begin(); it != layers.end(); it++)
+        {
+            Layer layer;
+            layer.activation = activation_code(it->first);
+            layer.input_size = it->second.shape[0];
+            layer.output_size = it->second.shape[1];
+
+            // Transpose so every output node reads a contiguous weight row
+            float *data = it->second.data<float>();
+            layer.weights.resize(layer.input_size * layer.output_size);
+            for (size_t node = 0; node < layer.input_size; node++)
+                for (size_t i = 0; i < layer.output_size; i++)
+                    layer.weights[i * layer.input_size + node] = data[node * layer.output_size + i];
+
+            model.push_back(layer);
+        }
+    }
+
+    size_t getOutputLength() const
+    {
+        return model.back().output_size;
+    }
+
+    // Same contract as NpuSession::run, safe to call from several threads
+    void run(const float *input, size_t length, std::vector<float> &results) const
+    {
+        thread_local std::vector<float> current, next;
+        current.assign(input, input + length);
+
+        for (const Layer &layer : model)
+        {
+            next.resize(layer.output_size);
+            for (size_t i = 0; i < layer.output_size; i++)
+                next[i] = dot(&layer.weights[i * layer.input_size], current.data(), layer.input_size);
+            activate(layer.activation, next.data(), next.size());
+            current.swap(next);
+        }
+
+        results.insert(results.end(), current.begin(), current.end());
+    }
+
+private:
+    struct Layer
+    {
+        unsigned int activation;
+        size_t input_size, output_size;
+        std::vector<float> weights; // [output_size][input_size]
+    };
+
+    std::vector<Layer> model;
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef DATASET_CACHE_HPP
+#define DATASET_CACHE_HPP
+
+#include <cnpy.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "result_cache.hpp"
+
+// Rows and labels of a dataset, rows `stride` floats apart
+struct Dataset
+{
+    size_t samples, row_length, stride;
+    const float *inputs;
+    const char *labels;
+
+    const float *row(size_t n) const
+    {
+        return inputs + n * stride;
+    }
+};
+
+// View of the "x" and "y" arrays of a dataset.npz
+inline Dataset dataset_view(cnpy::npz_t &arrays)
+{
+    return {arrays["x"].shape[0], arrays["x"].shape[1], arrays["x"].shape[1], arrays["x"].data<float>(), arrays["y"].data<char>()};
+}
+
+// Key of a file from its size and modification time, 0 if it cannot be found:
+// a rewritten file gets a new key without being read
+inline uint64_t file_key(const std::string &path, uint64_t seed = 0)
+{
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+        return 0;
+    uint64_t fields[] = {(uint64_t)status.st_size, (uint64_t)status.st_mtim.tv_sec, (uint64_t)status.st_mtim.tv_nsec};
+    return xxh64(fields, sizeof(fields), seed);
+}
+
+const char DATASET_CACHE_MAGIC[] = "NPUDATA1";
+
+// Dataset converted once to a flat file mapped by later runs: a header, the rows
+// zero-padded to a 64-byte stride from a page boundary, then one byte per label.
+// The header keeps the key of the source it was converted from, so a stale file
+// is converted again, and a hash of the content checked on demand by verify().
+class DatasetCache
+{
+public:
+    DatasetCache() : base(NULL), size(0) {}
+
+    ~DatasetCache()
+    {
+        close();
+    }
+
+    // Map the cache at `path` if it was converted from `source`; the content is
+    // not read
+    bool open(const std::string &path, uint64_t source)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat status;
+        fstat(fd, &status);
+        void *data = (size_t)status.st_size >= sizeof(Header) ? mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return false;
+
+        const Header *header = (const Header *)data;
+        const uint8_t *bytes = (const uint8_t *)data;
+        madvise(data, status.st_size, MADV_WILLNEED);
+        if (memcmp(header->magic, DATASET_CACHE_MAGIC, 8) != 0 || header->source != source || header->bytes != (uint64_t)status.st_size)
+        {
+            munmap(data, status.st_size);
+            return false;
+        }
+
+        base = (uint8_t *)data;
+        size = status.st_size;
+        dataset = {header->samples, header->row_length, header->stride, (const float *)(bytes + header->rows_offset), (const char *)(bytes + header->labels_offset)};
+        return true;
+    }
+
+    // Convert a dataset into a cache file, written aside and renamed into place
+    static bool write(const std::string &path, const Dataset &dataset, uint64_t source)
+    {
+        Header header;
+        memcpy(header.magic, DATASET_CACHE_MAGIC, 8);
+        header.source = source;
+        header.samples = dataset.samples;
+        header.row_length = dataset.row_length;
+        header.stride = (dataset.row_length + 15) / 16 * 16;
+        header.rows_offset = 4096;
+        header.labels_offset = header.rows_offset + header.samples * header.stride * sizeof(float);
+        header.bytes = header.labels_offset + header.samples;
+
+        std::vector<uint8_t> file(header.bytes, 0);
+        for (size_t n = 0; n < dataset.samples; n++)
+            memcpy(&file[header.rows_offset + n * header.stride * sizeof(float)], dataset.row(n), dataset.row_length * sizeof(float));
+        memcpy(&file[header.labels_offset], dataset.labels, dataset.samples);
+        header.hash = xxh64(&file[sizeof(Header)], file.size() - sizeof(Header), 0);
+        memcpy(file.data(), &header, sizeof(Header));
+
+        std::string temporary = path + ".tmp";
+        FILE *out = fopen(temporary.c_str(), "wb");
+        if (out == NULL)
+            return false;
+        bool written = fwrite(file.data(), 1, file.size(), out) == file.size();
+        written = fclose(out) == 0 && written;
+        if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Hash the whole content against the header, which reads every page
+    bool verify() const
+    {
+        return base != NULL && xxh64(base + sizeof(Header), size - sizeof(Header), 0) == ((const Header *)base)->hash;
+    }
+
+    void close()
+    {
+        if (base != NULL)
+            munmap(base, size);
+        base = NULL;
+        size = 0;
+    }
+
+    bool isOpen() const
+    {
+        return base != NULL;
+    }
+
+    const Dataset &getDataset() const
+    {
+        return dataset;
+    }
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint64_t source; // file_key() of what the cache was converted from
+        uint64_t samples, row_length, stride;
+        uint64_t rows_offset, labels_offset, bytes;
+        uint64_t hash; // Of everything after the header
+    };
+
+    uint8_t *base;
+    size_t size;
+    Dataset dataset;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef DMA_BUFFER_HPP
+#define DMA_BUFFER_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+#include <string>
+#include "sysfs.hpp"
+
+// Window of physical memory shared with the DMA. Uncached windows are mapped
+// through /dev/mem, write-combined and cached ones through the u-dma-buf buffer
+// covering the window; cached ones need cache maintenance around every transfer.
+class DmaBuffer
+{
+public:
+    enum Mapping
+    {
+        Uncached,      // Every CPU access goes to memory
+        WriteCombined, // Stores merged into bursts, loads uncached
+        Cached         // Write-back, cleaned before and invalidated after transfers
+    };
+
+    static bool parse(const std::string &name, Mapping &mapping)
+    {
+        if (name == "uncached")
+            mapping = Uncached;
+        else if (name == "wc")
+            mapping = WriteCombined;
+        else if (name == "cached")
+            mapping = Cached;
+        else
+            return false;
+        return true;
+    }
+
+    static const char *getName(Mapping mapping)
+    {
+        const char *names[] = {"uncached", "write-combined", "cached+flush"};
+        return names[mapping];
+    }
+
+    DmaBuffer(unsigned long physical, size_t size, Mapping mapping, const std::string &root = "/sys/class/u-dma-buf", const std::string &devices = "/dev")
+        : base(NULL), size(size), mapping(mapping), offset(physical)
+    {
+        std::string device = "/dev/mem";
+        int flags = O_RDWR | O_SYNC;
+        if (mapping != Uncached)
+        {
+            device.clear();
+            for (const std::string &name : sysfs_list(root))
+            {
+                std::string start = sysfs_read(root + "/" + name + "/phys_addr");
+                if (start.empty())
+                    continue;
+                unsigned long address = std::stoul(start, NULL, 16), length = sysfs_read_value(root + "/" + name + "/size");
+                if (physical >= address && physical + size <= address + length)
+                {
+                    attributes = root + "/" + name;
+                    device = devices + "/" + name;
+                    offset = physical - address;
+                    break;
+                }
+            }
+            if (device.empty())
+                return;
+
+            // sync_mode only applies to O_SYNC opens, 2 selects write-combine.
+            // The buffer is shared, so the previous mode is put back once mapped.
+            if (mapping == WriteCombined)
+            {
+                previous_sync_mode = sysfs_read(attributes + "/sync_mode");
+                if (previous_sync_mode == "2")
+                    previous_sync_mode.clear();
+                else if (!sysfs_write(attributes + "/sync_mode", "2"))
+                    return;
+            }
+            flags = mapping == WriteCombined ? O_RDWR | O_SYNC : O_RDWR;
+        }
+
+        int fd = open(device.c_str(), flags);
+        void *window = fd >= 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset) : MAP_FAILED;
+        if (fd >= 0)
+            close(fd);
+        if (window != MAP_FAILED)
+            base = (uint8_t *)window;
+
+        // u-dma-buf picks the page attributes at mmap, later changes leave the window as is
+        if (!previous_sync_mode.empty())
+            sysfs_write(attributes + "/sync_mode", previous_sync_mode);
+    }
+
+    ~DmaBuffer()
+    {
+        if (base != NULL)
+            munmap(base, size);
+    }
+
+    bool isMapped() const
+    {
+        return base != NULL;
+    }
+
+    Mapping getMapping() const
+    {
+        return mapping;
+    }
+
+    void *data()
+    {
+        return base;
+    }
+
+    // Write back CPU stores to [start, start + bytes) before the device reads them
+    void syncForDevice(size_t start, size_t bytes)
+    {
+        if (mapping == Cached)
+            sync(start, bytes, 1, "sync_for_device");
+    }
+
+    // Drop stale lines of [start, start + bytes) after the device wrote them
+    void syncForCpu(size_t start, size_t bytes)
+    {
+        if (mapping == Cached)
+            sync(start, bytes, 2, "sync_for_cpu");
+    }
+
+private:
+    void sync(size_t start, size_t bytes, int direction, const char *command)
+    {
+#if defined(__aarch64__)
+        // Linux lets EL0 clean and invalidate by address, no need for the driver
+        (void)direction;
+        (void)command;
+        uint64_t ctr;
+        asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+        uintptr_t line = 4 << ((ctr >> 16) & 0xF);
+        for (uintptr_t p = ((uintptr_t)base + start) & ~(line - 1); p < (uintptr_t)base + start + bytes; p += line)
+            asm volatile("dc civac, %0" ::"r"(p) : "memory");
+        asm volatile("dsb sy" ::: "memory");
+#else
+        // ARMv7 user space cannot reach the point of coherency, go through u-dma-buf
+        sysfs_write(attributes + "/sync_offset", std::to_string(offset + start));
+        sysfs_write(attributes + "/sync_size", std::to_string(bytes));
+        sysfs_write(attributes + "/sync_direction", std::to_string(direction));
+        sysfs_write(attributes + "/" + command, "1");
+#endif
+    }
+
+    uint8_t *base;
+    size_t size;
+    Mapping mapping;
+    unsigned long offset;   // In the device mapped
+    std::string attributes; // u-dma-buf sysfs directory
+    std::string previous_sync_mode; // To restore after mapping, empty if left as found
+};
+
+#endif
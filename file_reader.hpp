@@ -0,0 +1,262 @@
+#ifndef FILE_READER_HPP
+#define FILE_READER_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(NPU_HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+// Evict the pages of a file from the page cache, so the next read is cold
+inline bool drop_cached_pages(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    fdatasync(fd);
+    bool dropped = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return dropped;
+}
+
+// Reads a file front to back in page-aligned chunks, keeping `depth` reads in
+// flight ahead of the consumer: through io_uring when built with
+// NPU_HAVE_LIBURING and the kernel supports it, otherwise with a thread issuing
+// preads. Chunks are handed out in file order.
+class FileReader
+{
+public:
+    FileReader(const std::string &path, size_t chunk = 1 << 20, size_t depth = 4)
+        : chunk((chunk + 4095) / 4096 * 4096), depth(std::max<size_t>(depth, 1)), size(0), chunks(0),
+          current(0), holding(false), failed(false), landed(0), consumed(0), stopping(false), uring(false)
+    {
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat status;
+        fstat(fd, &status);
+        size = status.st_size;
+        chunks = (size + this->chunk - 1) / this->chunk;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        buffers.resize(this->depth);
+        lengths.resize(this->depth, 0);
+        for (uint8_t *&buffer : buffers)
+        {
+            if (posix_memalign((void **)&buffer, 4096, this->chunk) != 0)
+                buffer = NULL;
+        }
+
+#if defined(NPU_HAVE_LIBURING)
+        uring = io_uring_queue_init(this->depth, &ring, 0) == 0;
+        if (uring)
+        {
+            ready.resize(this->depth, false);
+            for (size_t c = 0; c < std::min(this->depth, chunks); c++)
+                submit(c);
+            return;
+        }
+#endif
+        worker = std::thread(&FileReader::loop, this);
+    }
+
+    ~FileReader()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            changed.notify_all();
+            worker.join();
+        }
+#if defined(NPU_HAVE_LIBURING)
+        if (uring)
+        {
+            // Reads still in flight target the buffers
+            for (size_t c = consumed; c < std::min(consumed + depth, chunks); c++)
+                complete(c);
+            io_uring_queue_exit(&ring);
+        }
+#endif
+        for (uint8_t *buffer : buffers)
+            free(buffer);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool isOpen() const
+    {
+        return fd >= 0;
+    }
+
+    uint64_t getSize() const
+    {
+        return size;
+    }
+
+    const char *getBackend() const
+    {
+        return uring ? "io_uring" : "pread thread";
+    }
+
+    // Whether next() stopped on a read error rather than the end of the file
+    bool hasFailed() const
+    {
+        return failed;
+    }
+
+    // Next chunk of the file, valid until the following call; false at the end of
+    // the file or on a read error (see hasFailed())
+    bool next(const uint8_t *&data, size_t &length)
+    {
+        if (holding)
+        {
+            release();
+            current++;
+            holding = false;
+        }
+        if (current >= chunks)
+            return false;
+
+#if defined(NPU_HAVE_LIBURING)
+        if (uring)
+            complete(current);
+#endif
+        if (!uring)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this]() { return landed > current; });
+        }
+
+        holding = true;
+        data = buffers[current % depth];
+        length = lengths[current % depth];
+        if (length != expected(current))
+            failed = true;
+        return !failed;
+    }
+
+private:
+    size_t expected(size_t c) const
+    {
+        return std::min<uint64_t>(chunk, size - c * chunk);
+    }
+
+    // Read the remainder of a chunk after a short read
+    size_t finish(size_t c, size_t length)
+    {
+        while (length < expected(c))
+        {
+            ssize_t read = pread(fd, buffers[c % depth] + length, expected(c) - length, c * chunk + length);
+            if (read <= 0)
+                break;
+            length += read;
+        }
+        return length;
+    }
+
+    // The buffer of the current chunk can take the chunk `depth` ahead
+    void release()
+    {
+#if defined(NPU_HAVE_LIBURING)
+        if (uring)
+        {
+            consumed++;
+            if (current + depth < chunks)
+                submit(current + depth);
+            return;
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            consumed++;
+        }
+        changed.notify_all();
+    }
+
+    void loop()
+    {
+        for (size_t c = 0; c < chunks; c++)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return stopping || c < consumed + depth; });
+                if (stopping)
+                    return;
+            }
+
+            size_t length = buffers[c % depth] != NULL ? finish(c, 0) : 0;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                lengths[c % depth] = length;
+                landed++;
+            }
+            changed.notify_all();
+        }
+    }
+
+#if defined(NPU_HAVE_LIBURING)
+    void submit(size_t c)
+    {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_read(sqe, fd, buffers[c % depth], expected(c), c * chunk);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)c);
+        ready[c % depth] = false;
+        io_uring_submit(&ring);
+    }
+
+    // Reap completions until chunk c has landed, they may come out of order
+    void complete(size_t c)
+    {
+        while (!ready[c % depth])
+        {
+            struct io_uring_cqe *cqe;
+            if (io_uring_wait_cqe(&ring, &cqe) != 0)
+            {
+                lengths[c % depth] = 0;
+                ready[c % depth] = true;
+                break;
+            }
+            size_t done = (uintptr_t)io_uring_cqe_get_data(cqe);
+            lengths[done % depth] = cqe->res > 0 ? finish(done, cqe->res) : 0;
+            ready[done % depth] = true;
+            io_uring_cqe_seen(&ring, cqe);
+        }
+    }
+
+    struct io_uring ring;
+    std::vector<bool> ready;
+#endif
+
+    int fd;
+    size_t chunk, depth;
+    uint64_t size;
+    size_t chunks;
+    size_t current; // Chunk handed out or to hand out next
+    bool holding;   // The consumer still holds the current chunk
+    bool failed;    // A chunk could not be read in full
+
+    std::vector<uint8_t *> buffers;
+    std::vector<size_t> lengths;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t landed, consumed;
+    bool stopping;
+    bool uring;
+};
+
+#endif
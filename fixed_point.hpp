@@ -0,0 +1,254 @@
+#ifndef FIXED_POINT_HPP
+#define FIXED_POINT_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#include "activation.hpp"
+
+// Signed fixed-point datapath: operands are Q(word_length, fraction_bits), products
+// are accumulated in an accumulator_length-bit register with 2 * fraction_bits
+// fractional bits, and results are rounded back to the operand format.
+struct FixedPointFormat
+{
+    enum Rounding
+    {
+        Truncate,   // Towards minus infinity (drop the low bits)
+        Nearest,    // Ties towards plus infinity
+        NearestEven // Ties to even
+    };
+
+    unsigned int word_length = 16;        // Up to 16 bits so products fit 32 bits
+    unsigned int fraction_bits = 8;
+    unsigned int accumulator_length = 32; // Up to 32 bits
+    Rounding rounding = Nearest;
+    bool saturate = true;                 // Wrap around otherwise
+    bool piecewise_sigmoid = true;        // PLAN approximation, exact sigmoid otherwise
+
+    // "<word>.<fraction>[,round=truncate|nearest|even][,overflow=saturate|wrap][,acc=<bits>][,sigmoid=piecewise|exact]",
+    // false with the reason in `error` if the spec is invalid
+    static bool parse(const std::string &spec, FixedPointFormat &format, std::string &error)
+    {
+        format = FixedPointFormat();
+        std::stringstream list(spec);
+        std::string setting;
+        std::getline(list, setting, ',');
+        size_t dot = setting.find('.');
+        if (dot == std::string::npos || !parseBits(setting.substr(0, dot), format.word_length) ||
+            !parseBits(setting.substr(dot + 1), format.fraction_bits))
+        {
+            error = "fixed-point format must start with <word>.<fraction>";
+            return false;
+        }
+
+        while (std::getline(list, setting, ','))
+        {
+            std::string key = setting.substr(0, setting.find('='));
+            std::string value = setting.find('=') == std::string::npos ? "" : setting.substr(setting.find('=') + 1);
+            if (key == "round" && value == "truncate")
+                format.rounding = Truncate;
+            else if (key == "round" && value == "nearest")
+                format.rounding = Nearest;
+            else if (key == "round" && value == "even")
+                format.rounding = NearestEven;
+            else if (key == "overflow" && (value == "saturate" || value == "wrap"))
+                format.saturate = value == "saturate";
+            else if (key == "acc" && parseBits(value, format.accumulator_length))
+                continue;
+            else if (key == "sigmoid" && (value == "piecewise" || value == "exact"))
+                format.piecewise_sigmoid = value == "piecewise";
+            else
+            {
+                error = "unknown fixed-point setting \"" + setting + "\"";
+                return false;
+            }
+        }
+
+        if (format.word_length < 2 || format.word_length > 16 || format.fraction_bits >= format.word_length ||
+            format.accumulator_length < format.word_length || format.accumulator_length > 32)
+        {
+            error = "unsupported fixed-point format \"" + spec + "\"";
+            return false;
+        }
+        return true;
+    }
+
+    // Bring a wide value into `bits` bits
+    int32_t overflow(int64_t value, unsigned int bits) const
+    {
+        int64_t max = (1LL << (bits - 1)) - 1, min = -(1LL << (bits - 1));
+        if (saturate)
+            return value > max ? max : value < min ? min : value;
+        uint64_t mask = (bits == 64) ? ~0ULL : (1ULL << bits) - 1;
+        uint64_t wrapped = (uint64_t)value & mask;
+        return (int32_t)((wrapped ^ (1ULL << (bits - 1))) - (1ULL << (bits - 1)));
+    }
+
+    // Divide by 2^shift with the configured rounding
+    int64_t shift(int64_t value, unsigned int shift) const
+    {
+        if (shift == 0)
+            return value;
+        int64_t floor = value >> shift;
+        int64_t remainder = value - (floor << shift), half = 1LL << (shift - 1);
+        if (rounding == Truncate || remainder < half)
+            return floor;
+        if (remainder > half || rounding == Nearest)
+            return floor + 1;
+        return floor + (floor & 1);
+    }
+
+    int32_t quantize(float value) const
+    {
+        double scaled = std::ldexp((double)value, fraction_bits);
+        double floor = std::floor(scaled), remainder = scaled - floor;
+        int64_t raw = (int64_t)floor;
+        if (rounding == Nearest && remainder >= 0.5)
+            raw++;
+        else if (rounding == NearestEven && (remainder > 0.5 || (remainder == 0.5 && (raw & 1))))
+            raw++;
+        return overflow(raw, word_length);
+    }
+
+    float dequantize(int32_t raw) const
+    {
+        return std::ldexp((float)raw, -(int)fraction_bits);
+    }
+
+    // Accumulator register after adding `product`
+    int32_t accumulate(int32_t accumulator, int32_t product) const
+    {
+        return overflow((int64_t)accumulator + product, accumulator_length);
+    }
+
+    // Accumulator (2 * fraction_bits) back to the operand format
+    int32_t requantize(int32_t accumulator) const
+    {
+        return overflow(shift(accumulator, fraction_bits), word_length);
+    }
+
+    // Activation of an NPU instruction on operand-format values
+    void activate(unsigned int activation, int32_t *values, size_t length) const
+    {
+        if (activation == 2)
+        {
+            for (size_t i = 0; i < length; i++)
+                values[i] = std::max(values[i], 0);
+        }
+        else if (activation == 1 && piecewise_sigmoid)
+        {
+            // PLAN (Amin et al.): slopes are powers of two, only shifts and adds
+            int32_t one = 1 << fraction_bits;
+            int32_t limit = quantize(5.0f), knee = quantize(2.375f);
+            int32_t b1 = quantize(0.84375f), b2 = quantize(0.625f), b3 = quantize(0.5f);
+            for (size_t i = 0; i < length; i++)
+            {
+                int32_t x = std::abs(values[i]), y;
+                if (x >= limit)
+                    y = one;
+                else if (x >= knee)
+                    y = (x >> 5) + b1;
+                else if (x >= one)
+                    y = (x >> 3) + b2;
+                else
+                    y = (x >> 2) + b3;
+                values[i] = overflow(values[i] < 0 ? one - y : y, word_length);
+            }
+        }
+        else if (activation == 1 || activation == 3)
+        {
+            std::vector<float> real(length);
+            for (size_t i = 0; i < length; i++)
+                real[i] = dequantize(values[i]);
+            ::activate(activation, real.data(), length);
+            for (size_t i = 0; i < length; i++)
+                values[i] = quantize(real[i]);
+        }
+    }
+
+    std::string describe() const
+    {
+        const char *roundings[] = {"truncate", "nearest", "even"};
+        std::stringstream s;
+        s << "Q" << word_length << "." << fraction_bits << ", " << accumulator_length << "-bit accumulator, "
+          << roundings[rounding] << " rounding, " << (saturate ? "saturating" : "wrapping")
+          << ", " << (piecewise_sigmoid ? "piecewise" : "exact") << " sigmoid";
+        return s.str();
+    }
+private:
+    // Bit count of at most two digits
+    static bool parseBits(const std::string &text, unsigned int &bits)
+    {
+        if (text.empty() || text.size() > 2 || text.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        bits = std::stoul(text);
+        return true;
+    }
+};
+
+// Fixed-point counterpart of accumulate_tile(): every core adds input[node] * weight
+// into its accumulator in node order, overflow handled after every addition
+inline void accumulate_tile_fixed(const int32_t *input, const int32_t *weights, size_t inputs, size_t range, int32_t *accumulators, const FixedPointFormat &format)
+{
+#if defined(__ARM_NEON) || defined(__SSE4_1__)
+    const int guard = 32 - format.accumulator_length;
+    const int32_t max = (int32_t)((1LL << (format.accumulator_length - 1)) - 1), min = (int32_t)(-(1LL << (format.accumulator_length - 1)));
+#endif
+
+    for (size_t i = 0; i < range; i++)
+        accumulators[i] = 0;
+
+    for (size_t node = 0; node < inputs; node++)
+    {
+        const int32_t *row = weights + node * range;
+        int32_t x = input[node];
+        size_t i = 0;
+#if defined(__ARM_NEON)
+        int32x4_t xv = vdupq_n_s32(x), maxv = vdupq_n_s32(max), minv = vdupq_n_s32(min);
+        int32x4_t left = vdupq_n_s32(guard), right = vdupq_n_s32(-guard);
+        for (; i + 4 <= range; i += 4)
+        {
+            int32x4_t product = vmulq_s32(xv, vld1q_s32(row + i));
+            int32x4_t sum;
+            if (format.saturate)
+                sum = vminq_s32(vmaxq_s32(vqaddq_s32(vld1q_s32(accumulators + i), product), minv), maxv);
+            else
+                sum = vshlq_s32(vshlq_s32(vaddq_s32(vld1q_s32(accumulators + i), product), left), right);
+            vst1q_s32(accumulators + i, sum);
+        }
+#elif defined(__SSE4_1__)
+        __m128i xv = _mm_set1_epi32(x), maxv = _mm_set1_epi32(max), minv = _mm_set1_epi32(min);
+        for (; i + 4 <= range; i += 4)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(accumulators + i));
+            __m128i product = _mm_mullo_epi32(xv, _mm_loadu_si128((const __m128i *)(row + i)));
+            __m128i sum = _mm_add_epi32(a, product);
+            if (format.saturate)
+            {
+                // Signed overflow when both operands differ in sign from the sum
+                __m128i overflowed = _mm_and_si128(_mm_xor_si128(a, sum), _mm_xor_si128(product, sum));
+                __m128i limit = _mm_xor_si128(_mm_srai_epi32(a, 31), _mm_set1_epi32(INT32_MAX));
+                sum = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(sum), _mm_castsi128_ps(limit), _mm_castsi128_ps(overflowed)));
+                sum = _mm_min_epi32(_mm_max_epi32(sum, minv), maxv);
+            }
+            else
+            {
+                __m128i count = _mm_cvtsi32_si128(guard);
+                sum = _mm_sra_epi32(_mm_sll_epi32(sum, count), count);
+            }
+            _mm_storeu_si128((__m128i *)(accumulators + i), sum);
+        }
+#endif
+        for (; i < range; i++)
+            accumulators[i] = format.accumulate(accumulators[i], x * row[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef FOLDING_HPP
+#define FOLDING_HPP
+
+#include <cnpy.h>
+#include <cmath>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "activation.hpp"
+
+// Input normalization x' = (x - mean) / std, one value per input or one for all
+struct InputNormalization
+{
+    std::vector<float> mean, std;
+};
+
+// Parse "MEAN,STD" or the path of an npz holding "mean" and "std" arrays
+inline bool parse_normalization(const std::string &spec, InputNormalization &normalization)
+{
+    if (spec.size() > 4 && spec.compare(spec.size() - 4, 4, ".npz") == 0)
+    {
+        cnpy::npz_t arrays = cnpy::npz_load(spec);
+        if (arrays.count("mean") == 0 || arrays.count("std") == 0)
+            return false;
+        normalization.mean = arrays["mean"].as_vec<float>();
+        normalization.std = arrays["std"].as_vec<float>();
+        return true;
+    }
+
+    std::stringstream values(spec);
+    std::string mean, std;
+    if (!std::getline(values, mean, ',') || !std::getline(values, std, ','))
+        return false;
+    normalization.mean.assign(1, std::stof(mean));
+    normalization.std.assign(1, std::stof(std));
+    return true;
+}
+
+// What was folded into the layers
+struct FoldReport
+{
+    size_t batch_norms;  // Batch-norm layers folded
+    bool input;          // Input normalization folded into the first layer
+    bool constant_input; // Inputs need a trailing 1 carrying the biases
+};
+
+// Append a column of ones to every row of a dataset, for models whose biases
+// ride on a constant input
+inline cnpy::NpyArray append_constant_input(const cnpy::NpyArray &x)
+{
+    size_t rows = x.shape[0], length = x.shape[1];
+    cnpy::NpyArray augmented({rows, length + 1}, sizeof(float), false);
+    const float *source = x.data<float>();
+    float *destination = augmented.data<float>();
+    for (size_t n = 0; n < rows; n++)
+    {
+        std::copy(source + n * length, source + (n + 1) * length, destination + n * (length + 1));
+        destination[n * (length + 1) + length] = 1;
+    }
+    return augmented;
+}
+
+// Fold batch-norm arrays and an optional input normalization into the dense
+// layers of a model. Batch norm of layer "a<i>_<activation>_<i>" is read from
+// "bn<i>_scale" and "bn<i>_shift", or from "bn<i>_gamma", "bn<i>_beta",
+// "bn<i>_mean" and "bn<i>_variance", and applies before the activation.
+//
+// The NPU has no bias, so a layer ending up with one gets an extra input row
+// holding it, fed by a constant unit: the input row takes a trailing 1 (see
+// append_constant_input) and every layer before gets an output column that
+// evaluates to a constant. Returns the layer list for NpuSession::load().
+inline cnpy::npz_t fold_normalization(const cnpy::npz_t &arrays, const InputNormalization *normalization, FoldReport &report, float epsilon = 1e-3f)
+{
+    struct Layer
+    {
+        std::string name;
+        size_t inputs, outputs;
+        std::vector<float> weights; // [inputs][outputs]
+        std::vector<double> bias;   // Empty for none
+    };
+    std::vector<Layer> layers;
+    std::map<std::string, std::map<std::string, const cnpy::NpyArray *>> norms;
+    std::regex bn("bn(\\d+)_([a-z]+)"), layer_index("a(\\d+)_");
+
+    for (cnpy::npz_t::const_iterator it = arrays.begin(); it != arrays.end(); it++)
+    {
+        std::smatch match;
+        if (std::regex_match(it->first, match, bn))
+        {
+            norms[match.str(1)][match.str(2)] = &it->second;
+            continue;
+        }
+        const float *data = it->second.data<float>();
+        layers.push_back({it->first, it->second.shape[0], it->second.shape[1], std::vector<float>(data, data + it->second.num_vals), {}});
+    }
+    report = {0, false, false};
+
+    if (normalization != NULL && !layers.empty())
+    {
+        Layer &first = layers.front();
+        first.bias.assign(first.outputs, 0);
+        for (size_t i = 0; i < first.inputs; i++)
+        {
+            float mean = normalization->mean.size() > 1 ? normalization->mean.at(i) : normalization->mean[0];
+            float std = normalization->std.size() > 1 ? normalization->std.at(i) : normalization->std[0];
+            for (size_t j = 0; j < first.outputs; j++)
+            {
+                first.weights[i * first.outputs + j] /= std;
+                first.bias[j] -= mean * first.weights[i * first.outputs + j];
+            }
+        }
+        report.input = true;
+    }
+
+    for (std::map<std::string, std::map<std::string, const cnpy::NpyArray *>>::iterator it = norms.begin(); it != norms.end(); it++)
+    {
+        Layer *layer = NULL;
+        for (Layer &l : layers)
+        {
+            std::smatch match;
+            if (std::regex_search(l.name, match, layer_index) && match.str(1) == it->first)
+                layer = &l;
+        }
+        if (layer == NULL)
+            throw std::runtime_error("fold_normalization: no layer for bn" + it->first);
+
+        std::map<std::string, const cnpy::NpyArray *> &p = it->second;
+        std::vector<double> scale(layer->outputs, 1), shift(layer->outputs, 0);
+        for (size_t j = 0; j < layer->outputs; j++)
+        {
+            if (p.count("scale") || p.count("shift"))
+            {
+                scale[j] = p.count("scale") ? p["scale"]->data<float>()[j] : 1;
+                shift[j] = p.count("shift") ? p["shift"]->data<float>()[j] : 0;
+                continue;
+            }
+            double variance = p.count("variance") ? p["variance"]->data<float>()[j] : 1;
+            scale[j] = (p.count("gamma") ? p["gamma"]->data<float>()[j] : 1) / std::sqrt(variance + epsilon);
+            shift[j] = (p.count("beta") ? p["beta"]->data<float>()[j] : 0) - (p.count("mean") ? p["mean"]->data<float>()[j] : 0) * scale[j];
+        }
+
+        layer->bias.resize(layer->outputs, 0);
+        for (size_t j = 0; j < layer->outputs; j++)
+        {
+            for (size_t i = 0; i < layer->inputs; i++)
+                layer->weights[i * layer->outputs + j] *= scale[j];
+            layer->bias[j] = layer->bias[j] * scale[j] + shift[j];
+        }
+        report.batch_norms++;
+    }
+
+    // Carry the constant unit up to the last layer with a bias
+    size_t last = layers.size();
+    for (size_t l = 0; l < layers.size(); l++)
+    {
+        if (!layers[l].bias.empty())
+            last = l;
+    }
+    double constant = 1; // Value of the constant unit entering a layer
+    for (size_t l = 0; l < layers.size() && last < layers.size() && l <= last; l++)
+    {
+        Layer &layer = layers[l];
+        unsigned int activation = activation_code(layer.name);
+        size_t outputs = layer.outputs + (l < last ? 1 : 0);
+        if (l < last && activation == 3)
+            throw std::runtime_error("fold_normalization: cannot carry a bias through softmax layer " + layer.name);
+
+        std::vector<float> weights((layer.inputs + 1) * outputs, 0);
+        for (size_t i = 0; i < layer.inputs; i++)
+            std::copy(&layer.weights[i * layer.outputs], &layer.weights[(i + 1) * layer.outputs], &weights[i * outputs]);
+        for (size_t j = 0; j < layer.outputs && !layer.bias.empty(); j++)
+            weights[layer.inputs * outputs + j] = layer.bias[j] / constant;
+
+        if (l < last)
+        {
+            // Pre-activation of 1, the next layer divides by what the activation makes of it
+            weights[layer.inputs * outputs + layer.outputs] = 1 / constant;
+            float value = 1;
+            activate(activation, &value, 1);
+            constant = value;
+        }
+
+        layer.inputs++;
+        layer.outputs = outputs;
+        layer.weights.swap(weights);
+        report.constant_input = true;
+    }
+
+    cnpy::npz_t folded;
+    for (const Layer &layer : layers)
+    {
+        cnpy::NpyArray array({layer.inputs, layer.outputs}, sizeof(float), false);
+        std::copy(layer.weights.begin(), layer.weights.end(), array.data<float>());
+        folded[layer.name] = array;
+    }
+    return folded;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef GRAPH_OPTIMIZER_HPP
+#define GRAPH_OPTIMIZER_HPP
+
+#include <cnpy.h>
+#include <regex>
+#include <string>
+#include <vector>
+#include "activation.hpp"
+
+// Size of a layer list as the NPU executes it
+struct GraphCost
+{
+    size_t layers;
+    unsigned long macs;         // Multiply-accumulates per sample
+    unsigned long weight_bytes; // Streamed on the weight channel
+};
+
+// What the optimizer changed
+struct GraphOptimization
+{
+    GraphCost before, after;
+    size_t fused;         // Linear layers multiplied into the next one
+    bool softmax_dropped; // Final softmax turned linear
+};
+
+// What dead-neuron pruning removed
+struct PruneReport
+{
+    GraphCost before, after;
+    size_t neurons; // Hidden neurons removed
+};
+
+inline GraphCost graph_cost(const cnpy::npz_t &layers)
+{
+    GraphCost cost = {layers.size(), 0, 0};
+    for (cnpy::npz_t::const_iterator it = layers.begin(); it != layers.end(); it++)
+    {
+        cost.macs += it->second.shape[0] * it->second.shape[1];
+        cost.weight_bytes += it->second.shape[0] * it->second.shape[1] * sizeof(float);
+    }
+    return cost;
+}
+
+// Weights of two chained layers as one: (inputs x middle) . (middle x outputs)
+inline cnpy::NpyArray multiply_layers(const cnpy::NpyArray &first, const cnpy::NpyArray &second)
+{
+    size_t inputs = first.shape[0], middle = first.shape[1], outputs = second.shape[1];
+    cnpy::NpyArray product({inputs, outputs}, sizeof(float), false);
+    const float *a = first.data<float>(), *b = second.data<float>();
+    float *c = product.data<float>();
+    std::vector<double> row(outputs);
+
+    for (size_t i = 0; i < inputs; i++)
+    {
+        std::fill(row.begin(), row.end(), 0.0);
+        for (size_t k = 0; k < middle; k++)
+        {
+            double x = a[i * middle + k];
+            for (size_t j = 0; j < outputs; j++)
+                row[j] += x * b[k * outputs + j];
+        }
+        for (size_t j = 0; j < outputs; j++)
+            c[i * outputs + j] = row[j];
+    }
+    return product;
+}
+
+// Rewrite the layer list for fewer instructions and multiply-accumulates:
+// a layer without activation is multiplied into the next one when the product
+// is cheaper than the pair, and with `drop_softmax` (only the ranking of the
+// outputs is used) a final softmax is removed since it preserves the order.
+// Layers keep their npz names, so the order and activations of load() hold.
+inline cnpy::npz_t optimize_graph(const cnpy::npz_t &layers, bool drop_softmax, GraphOptimization &report)
+{
+    report.before = graph_cost(layers);
+    report.fused = 0;
+    report.softmax_dropped = false;
+
+    std::vector<std::pair<std::string, cnpy::NpyArray>> list(layers.begin(), layers.end());
+    for (size_t l = 0; l + 1 < list.size();)
+    {
+        const cnpy::NpyArray &first = list[l].second, &second = list[l + 1].second;
+        bool linear = activation_code(list[l].first) == 0;
+        if (linear && first.shape[1] == second.shape[0] &&
+            first.shape[0] * second.shape[1] < first.shape[0] * first.shape[1] + second.shape[0] * second.shape[1])
+        {
+            list[l + 1].second = multiply_layers(first, second);
+            list.erase(list.begin() + l);
+            report.fused++;
+        }
+        else
+        {
+            l++;
+        }
+    }
+
+    if (drop_softmax && !list.empty() && activation_code(list.back().first) == 3)
+    {
+        list.back().first = std::regex_replace(list.back().first, std::regex("_softmax_"), "_linear_");
+        report.softmax_dropped = true;
+    }
+
+    cnpy::npz_t optimized(list.begin(), list.end());
+    report.after = graph_cost(optimized);
+    return optimized;
+}
+
+// Remove hidden neurons that cannot change the output: those whose outgoing row
+// in the next layer is all zero, and those whose incoming weight column is all
+// zero, which output the activation of 0 for every sample. A constant 0 drops
+// out; otherwise the first such neuron of the layer is kept as a bias unit and
+// the rows of the others are added to its row. Shrinks the outputs of layer k
+// and the inputs of layer k + 1; the output layer keeps its size.
+inline cnpy::npz_t prune_dead_neurons(const cnpy::npz_t &layers, PruneReport &report)
+{
+    report.before = graph_cost(layers);
+    report.neurons = 0;
+
+    std::vector<std::string> names;
+    std::vector<std::vector<size_t>> shapes;
+    std::vector<std::vector<float>> weights;
+    for (cnpy::npz_t::const_iterator it = layers.begin(); it != layers.end(); it++)
+    {
+        names.push_back(it->first);
+        shapes.push_back(it->second.shape);
+        weights.push_back(it->second.as_vec<float>());
+    }
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t k = 0; k + 1 < names.size(); k++)
+        {
+            unsigned int activation = activation_code(names[k]);
+            size_t inputs = shapes[k][0], outputs = shapes[k][1], next = shapes[k + 1][1];
+            if (activation == 3 || shapes[k + 1][0] != outputs)
+                continue;
+            std::vector<float> &w = weights[k], &n = weights[k + 1];
+            float constant = 0; // Output of a neuron without incoming weights
+            activate(activation, &constant, 1);
+
+            std::vector<bool> dead(outputs, false);
+            size_t bias_unit = outputs, count = 0;
+            for (size_t j = 0; j < outputs; j++)
+            {
+                bool unused = std::all_of(&n[j * next], &n[(j + 1) * next], [](float x) { return x == 0; });
+                bool silent = true;
+                for (size_t i = 0; i < inputs && silent; i++)
+                    silent = w[i * outputs + j] == 0;
+
+                if (unused || (silent && constant == 0))
+                {
+                    dead[j] = true;
+                }
+                else if (silent && bias_unit == outputs)
+                {
+                    bias_unit = j;
+                }
+                else if (silent)
+                {
+                    for (size_t c = 0; c < next; c++)
+                        n[bias_unit * next + c] += n[j * next + c];
+                    dead[j] = true;
+                }
+                count += dead[j];
+            }
+            if (count == 0 || count == outputs)
+                continue;
+
+            size_t kept = outputs - count;
+            std::vector<float> pruned_w, pruned_n;
+            pruned_w.reserve(inputs * kept);
+            pruned_n.reserve(kept * next);
+            for (size_t i = 0; i < inputs; i++)
+            {
+                for (size_t j = 0; j < outputs; j++)
+                {
+                    if (!dead[j])
+                        pruned_w.push_back(w[i * outputs + j]);
+                }
+            }
+            for (size_t j = 0; j < outputs; j++)
+            {
+                if (!dead[j])
+                    pruned_n.insert(pruned_n.end(), &n[j * next], &n[(j + 1) * next]);
+            }
+            w.swap(pruned_w);
+            n.swap(pruned_n);
+            shapes[k][1] = kept;
+            shapes[k + 1][0] = kept;
+            report.neurons += count;
+            changed = true;
+        }
+    }
+
+    cnpy::npz_t pruned;
+    for (size_t l = 0; l < names.size(); l++)
+    {
+        cnpy::NpyArray array(shapes[l], sizeof(float), false);
+        std::copy(weights[l].begin(), weights[l].end(), array.data<float>());
+        pruned[names[l]] = array;
+    }
+    report.after = graph_cost(pruned);
+    return pruned;
+}
+
+#endif
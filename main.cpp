@@ -2,8 +2,31 @@
 #include <cxxopts.hpp> // https://github.com/jarro2783/cxxopts
 #include <regex>
 #include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <csignal>
+#include <cmath>
 #include "dma.hpp"
 #include "tqdm.hpp"
+#include "npu_session.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
+#include "result_cache.hpp"
+#include "cpu_backend.hpp"
+#include "work_stealing.hpp"
+#include "power_monitor.hpp"
+#include "system_monitor.hpp"
+#include "timer.hpp"
+#include "npu_simulator.hpp"
+#include "npz_reader.hpp"
+#include "scoring.hpp"
+#include "graph_optimizer.hpp"
+#include "folding.hpp"
+#include "dataset_cache.hpp"
+#include "process_pool.hpp"
+#include "pipe_io.hpp"
 
 void system_pause()
 {
@@ -11,270 +34,971 @@ void system_pause()
     std::cin.get();
 }
 
-int main(int argc, char *argv[])
+// Load an archive with cnpy, or through the read-ahead reader decoding as it reads
+cnpy::npz_t load_npz(const std::string &path, bool read_ahead)
 {
-    cxxopts::Options options("npu_tester", "Software to test NPU with different neural network architectures and datasets");
-    options.add_options()
-        ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
-        ("c,core", "Number of core in the NPU (REQUIRED)", cxxopts::value<int>())
-        ("d,dir", "Directory in which are layers.npz and datasets.npz files (REQUIRED)", cxxopts::value<std::string>())
-        ("h,help", "Print usage")
-    ;
+    return read_ahead ? npz_read(path) : cnpy::npz_load(path);
+}
 
-    auto result = options.parse(argc, argv);
+// Load a model with its batch norms and the input normalization folded into the
+// weights, exits if it disagrees with the dataset on the constant input
+cnpy::npz_t load_model(const std::string &path, bool read_ahead, const InputNormalization *normalization, bool constant_input)
+{
+    FoldReport report;
+    cnpy::npz_t layers = fold_normalization(load_npz(path, read_ahead), normalization, report);
+    if (report.constant_input != constant_input)
+    {
+        std::cout << path << (report.constant_input ? " needs" : " does not take") << " the constant input of the main model" << std::endl;
+        exit(1);
+    }
+    return layers;
+}
 
-    if (result.count("help") || result.count("dir") == 0 || result.count("core") == 0)
+// Order in which dataset rows are run: each request repeats an already-run row
+// with probability `duplicate_ratio`, otherwise it takes the next unseen row
+std::vector<size_t> sample_order(size_t samples, double duplicate_ratio)
+{
+    std::vector<size_t> order;
+    std::mt19937 generator(0);
+    std::bernoulli_distribution duplicate(duplicate_ratio);
+    size_t fresh = 0;
+    while (order.size() < samples)
     {
-      std::cout << options.help() << std::endl;
-      exit(0);
+        if (fresh > 0 && duplicate(generator))
+        {
+            order.push_back(order[std::uniform_int_distribution<size_t>(0, order.size() - 1)(generator)]);
+        }
+        else
+        {
+            order.push_back(fresh++);
+        }
     }
+    return order;
+}
 
-    unsigned int verbosity_level = result.count("verbose");
-    std::string dir = result["dir"].as<std::string>();
-    size_t core = result["core"].as<int>();
+// Load layers into the session, exiting if the source windows are too full for them
+size_t load_or_exit(NpuSession &session, cnpy::npz_t &layers, const std::string &name, size_t tiling = 0)
+{
+    size_t model = session.load(layers, tiling);
+    if (model == NpuSession::NO_MODEL)
+    {
+        std::cout << "No room left for " << name << " in the source windows (" << session.getConfigSpace() << " instruction bytes, "
+                  << session.getWeightSpace() << " weight bytes free)" << std::endl;
+        exit(1);
+    }
+    return model;
+}
+
+// Run every sample on both resident models, then evaluate for each confidence
+// threshold the cascade that escalates to the large model when the maximum output
+// of the small model is below the threshold (latency = small + large when escalated).
+// Samples the DMA failed on with either model are left out.
+void run_cascade(NpuSession &session, size_t small, size_t large, const Dataset &dataset, const std::vector<double> &thresholds)
+{
+    size_t samples = dataset.samples;
+    size_t row_length = dataset.row_length;
+    const char *output = dataset.labels;
 
     tqdm bar;
-    unsigned long int status, mem_status;
-    size_t correct_classification = 0, dst_length = 0, execution_time = 0;
     std::vector<float> results;
-    std::string layers_file("layers.npz");
-    std::string dataset_file("dataset.npz");
+    std::vector<float> confidence(samples);
+    std::vector<int> small_class(samples), large_class(samples);
+    std::vector<uint64_t> small_time(samples), large_time(samples); // ns
+    std::vector<bool> failed(samples, false);
 
-    cnpy::npz_t layers = cnpy::npz_load(dir + layers_file);
-    cnpy::npz_t dataset = cnpy::npz_load(dir + dataset_file);
-    float *input = dataset["x"].data<float>();
-    char *output = dataset["y"].data<char>();
+    for (size_t n = 0; n < samples; n++)
+    {
+        bar.progress(n, samples);
 
-    mmap_params config_src = {0x30100000, 65536};
-    mmap_params weight_src = {0x30110000, 33554432};
-    mmap_params io_src = {0x32110000, 262144};
-    mmap_params io_dst = {0x32130000, 262144};
+        small_time[n] = session.run(dataset.row(n), row_length, results, small);
+        failed[n] = session.hasFailed();
+        auto max = std::max_element(results.begin(), results.end());
+        confidence[n] = *max;
+        small_class[n] = max - results.begin();
+        results.clear();
 
-    DirectMemoryAccess *config = new DirectMemoryAccess(0x40400000, &config_src, NULL);
-    DirectMemoryAccess *weight = new DirectMemoryAccess(0x40410000, &weight_src, NULL);
-    DirectMemoryAccess *io = new DirectMemoryAccess(0x40420000, &io_src, &io_dst);
+        large_time[n] = session.run(dataset.row(n), row_length, results, large);
+        failed[n] = failed[n] || session.hasFailed();
+        large_class[n] = argmax(results);
+        results.clear();
+    }
+    bar.finish();
 
-    // Instructions number
-    config->writeSourceUInt64(layers.size());
+    size_t scored = std::count(failed.begin(), failed.end(), false);
+    for (double threshold : thresholds)
+    {
+        size_t escalations = 0, correct_classification = 0;
+        std::vector<double> latencies;
+        for (size_t n = 0; n < samples; n++)
+        {
+            if (failed[n])
+                continue;
+            bool escalate = confidence[n] < threshold;
+            int found = escalate ? large_class[n] : small_class[n];
+            escalations += escalate;
+            correct_classification += found == (int)output[n];
+            latencies.push_back((small_time[n] + (escalate ? large_time[n] : 0)) / 1000.0);
+        }
+
+        std::cout << "Threshold " << threshold
+                  << ": escalation " << (float)escalations / (float)scored * 100 << "%"
+                  << ", accuracy " << (float)correct_classification / (float)scored * 100 << "%"
+                  << ", mean " << mean(latencies) << " us"
+                  << ", p99 " << percentile(latencies, 99) << " us" << std::endl;
+    }
 
-    // Load weights and instructions
-    for (cnpy::npz_t::iterator it = layers.begin(); it != layers.end(); it++)
+    std::vector<double> large_only;
+    size_t large_correct = 0;
+    for (size_t n = 0; n < samples; n++)
     {
-        if (verbosity_level > 1)
+        if (failed[n])
+            continue;
+        large_only.push_back(large_time[n] / 1000.0);
+        large_correct += large_class[n] == (int)output[n];
+    }
+    std::cout << "Large model only: accuracy " << (float)large_correct / (float)scored * 100 << "%"
+              << ", mean " << mean(large_only) << " us"
+              << ", p99 " << percentile(large_only, 99) << " us" << std::endl;
+    if (scored < samples)
+        std::cout << "DMA failures: " << samples - scored << " samples not scored" << std::endl;
+}
+
+// Share the dataset between the NPU session (main thread) and CPU workers stealing
+// rows from the other end of the queue, and report who computed what. Returns the
+// samples computed by the CPU workers. Rows the DMA failed on are not scored.
+size_t run_heterogeneous(NpuSession &session, const CpuModel &cpu_model, const Dataset &dataset, size_t workers)
+{
+    size_t samples = dataset.samples;
+    size_t row_length = dataset.row_length;
+    const char *output = dataset.labels;
+
+    SampleQueue queue(samples);
+    std::vector<int> found(samples, -1);
+    std::vector<size_t> cpu_samples(workers, 0);
+    std::vector<double> cpu_cost(workers, 0);
+    std::atomic<double> npu_cost(0);
+    std::vector<std::thread> threads;
+
+    std::vector<float> results;
+    size_t npu_samples = 0, npu_failed = 0, n;
+    auto run_npu = [&]() {
+        auto start = std::chrono::steady_clock::now();
+        session.run(dataset.row(n), row_length, results);
+        double cost = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        npu_cost.store(npu_cost.load() == 0 ? cost : 0.9 * npu_cost.load() + 0.1 * cost);
+
+        if (session.hasFailed())
+            npu_failed++;
+        else
+            found[n] = argmax(results);
+        npu_samples++;
+        results.clear();
+    };
+
+    // The workers only steal once the NPU cost is known, so the first row goes to
+    // the NPU before they start
+    auto begin = std::chrono::steady_clock::now();
+    if (queue.takeFront(n))
+        run_npu();
+    for (size_t w = 0; w < workers; w++)
+    {
+        threads.emplace_back([&, w]() {
+            std::vector<float> results;
+            size_t n;
+            while (queue.steal(n, cpu_cost[w], npu_cost.load()))
+            {
+                auto start = std::chrono::steady_clock::now();
+                cpu_model.run(dataset.row(n), row_length, results);
+                double cost = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+                cpu_cost[w] = cpu_cost[w] == 0 ? cost : 0.9 * cpu_cost[w] + 0.1 * cost;
+
+                found[n] = argmax(results);
+                cpu_samples[w]++;
+                results.clear();
+            }
+        });
+    }
+
+    while (queue.takeFront(n))
+        run_npu();
+
+    for (std::thread &thread : threads)
+        thread.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    size_t correct_classification = 0;
+    for (size_t i = 0; i < samples; i++)
+        correct_classification += found[i] == (int)output[i];
+
+    std::cout << "Accuracy: " << (float)correct_classification / (float)(samples - npu_failed) * 100 << "%" << std::endl;
+    std::cout << "Throughput: " << samples / elapsed << " samples/s" << std::endl;
+    if (npu_failed > 0)
+        std::cout << "DMA failures: " << npu_failed << " samples not scored" << std::endl;
+    std::cout << "NPU: " << npu_samples << " samples (" << (float)npu_samples / (float)samples * 100 << "%), " << npu_cost.load() << " us/sample" << std::endl;
+    for (size_t w = 0; w < workers; w++)
+    {
+        std::cout << "CPU worker " << w << ": " << cpu_samples[w] << " samples (" << (float)cpu_samples[w] / (float)samples * 100 << "%), " << cpu_cost[w] << " us/sample" << std::endl;
+    }
+    return samples - npu_samples;
+}
+
+// Counters of one evaluation process, in shared memory
+struct ProcessCounters
+{
+    uint64_t samples, correct;
+    uint64_t begin, end; // Timer readings around the shard
+    LatencyHistogram latency;
+};
+
+// Evaluate the dataset with 1, 2, 4 ... `processes` forked workers, each running a
+// contiguous shard on a private single-threaded simulator (CPU model without
+// --simulate), merge their counters and report the scaling efficiency. Returns the
+// samples run over every process count.
+size_t run_processes(const Dataset &dataset, cnpy::npz_t &layers, size_t core, const Timer &timer, const NpuSimulator *simulator, size_t processes)
+{
+    SharedArray<ProcessCounters> counters(processes);
+    if (!counters.isMapped())
+    {
+        std::cout << "Unable to map the shared counters" << std::endl;
+        exit(1);
+    }
+
+    std::vector<size_t> counts;
+    for (size_t p = 1; p < processes; p *= 2)
+        counts.push_back(p);
+    counts.push_back(processes);
+
+    size_t inferences = 0;
+    std::cout << "Backend: " << (simulator != NULL ? "simulator" : "CPU model") << ", " << std::thread::hardware_concurrency() << " CPUs" << std::endl;
+    double single = 0;
+    for (size_t p : counts)
+    {
+        counters.clear();
+        bool succeeded = fork_workers(p, [&](size_t w) {
+            // Each worker only builds the backend it runs
+            NpuSimulator *device = NULL;
+            NpuSession *session = NULL;
+            CpuModel *cpu_model = NULL;
+            if (simulator != NULL)
+            {
+                device = new NpuSimulator(1);
+                if (simulator->isFixedPoint())
+                    device->setFixedPoint(simulator->getFixedPoint());
+                session = new NpuSession(core, 0, timer, device);
+                load_or_exit(*session, layers, "the model");
+            }
+            else
+            {
+                cpu_model = new CpuModel(layers);
+            }
+
+            ProcessCounters &c = counters[w];
+            std::vector<float> results;
+            c.begin = timer.now();
+            for (size_t n = dataset.samples * w / p; n < dataset.samples * (w + 1) / p; n++)
+            {
+                uint64_t start = timer.now();
+                if (session != NULL)
+                    session->run(dataset.row(n), dataset.row_length, results);
+                else
+                    cpu_model->run(dataset.row(n), dataset.row_length, results);
+                c.latency.add(timer.elapsed(start, timer.now()));
+                if ((int)argmax(results) == (int)dataset.labels[n])
+                    c.correct++;
+                c.samples++;
+                results.clear();
+            }
+            c.end = timer.now();
+
+            delete session;
+            delete device;
+            delete cpu_model;
+        });
+        if (!succeeded)
         {
-            std::cout << "Loading layer \"" << it->first << "..." << std::endl;
+            std::cout << "A worker of " << p << " processes failed" << std::endl;
+            exit(1);
         }
 
-        // Instructions
-        std::regex re("a\\d+\\_([a-z]+)\\_\\d+");
-        std::smatch match;
-        std::regex_search(it->first, match, re);
-        std::string result = match.str(1);
-        unsigned int activation = 0;
-        if (result == "sigmoid")
+        ProcessCounters total;
+        memset(&total, 0, sizeof(total));
+        uint64_t begin = counters[0].begin, end = counters[0].end;
+        for (size_t w = 0; w < p; w++)
         {
-            activation = 1;
+            total.samples += counters[w].samples;
+            total.correct += counters[w].correct;
+            total.latency.merge(counters[w].latency);
+            begin = std::min(begin, counters[w].begin);
+            end = std::max(end, counters[w].end);
         }
-        else if (result == "relu")
+
+        inferences += total.samples;
+        double throughput = total.samples / (timer.elapsed(begin, end) / 1e9);
+        if (p == 1)
+            single = throughput;
+        std::cout << p << " processes: " << throughput << " samples/s (x" << throughput / single << ", efficiency "
+                  << throughput / (single * p) * 100 << "%), accuracy " << (float)total.correct / (float)total.samples * 100
+                  << "%, p50 " << total.latency.percentile(50) / 1000 << " us, p99 " << total.latency.percentile(99) / 1000 << " us" << std::endl;
+    }
+    return inferences;
+}
+
+// Block of rows moving between the pipe threads
+struct PipeBlock
+{
+    std::vector<float> *buffer;
+    size_t bytes; // Input read or output to write, 0 ends the output
+};
+
+// Serve rows of `length` float32 read from `input` through the resident model and
+// write their outputs to `output` in order, as float32. A reader and a writer
+// thread move blocks of about 1 MiB with large reads and writes, so the pipe I/O
+// overlaps inference. Reports throughput on stderr, and the rows the DMA failed on,
+// whose outputs are NaN so the stream stays one output per row.
+void run_pipe(NpuSession &session, const Timer &timer, int input, int output, size_t length, bool constant_input)
+{
+    size_t outputs = session.getOutputLength();
+    size_t block_rows = std::max<size_t>((1 << 20) / (length * sizeof(float)), 1);
+    size_t block_bytes = block_rows * length * sizeof(float);
+    grow_pipe(input, block_bytes);
+    grow_pipe(output, block_rows * outputs * sizeof(float));
+
+    // Three blocks each way: one being read or written, one in inference, one spare
+    const size_t depth = 3;
+    std::vector<std::vector<float>> input_buffers(depth, std::vector<float>(block_rows * length));
+    std::vector<std::vector<float>> output_buffers(depth);
+    BlockQueue<PipeBlock> free_inputs, read_inputs, free_outputs, computed_outputs;
+    for (size_t d = 0; d < depth; d++)
+    {
+        output_buffers[d].reserve(block_rows * outputs);
+        free_inputs.push({&input_buffers[d], 0});
+        free_outputs.push({&output_buffers[d], 0});
+    }
+
+    std::thread reader([&]() {
+        for (size_t bytes = block_bytes; bytes == block_bytes;)
         {
-            activation = 2;
+            PipeBlock block = free_inputs.pop();
+            bytes = block.bytes = read_full(input, block.buffer->data(), block_bytes);
+            read_inputs.push(block);
         }
-        else if (result == "softmax")
+    });
+    std::atomic<bool> write_failed(false);
+    std::thread writer([&]() {
+        for (PipeBlock block = computed_outputs.pop(); block.bytes > 0; block = computed_outputs.pop())
         {
-            activation = 3;
+            if (!write_failed && !write_full(output, block.buffer->data(), block.bytes))
+                write_failed = true;
+            free_outputs.push(block);
         }
+    });
 
-        uint64_t layer_input_shape = it->second.shape[0];
-        uint64_t layer_output_shape = it->second.shape[1];
-        uint64_t activation_cast = activation;
-        uint64_t instruction = (layer_input_shape << 34) + (layer_output_shape << 4) + activation_cast;
-        
-        config->writeSourceUInt64(instruction);
-        dst_length = it->second.shape[1]; // Save output size for destination length
+    uint64_t start = timer.now(), inference = 0;
+    size_t rows = 0, trailing = 0, failed = 0;
+    std::vector<float> staged(length + 1, 1);
+    for (bool last = false; !last;)
+    {
+        PipeBlock in = read_inputs.pop(), out = free_outputs.pop();
+        // Once the output is closed the rest of the input is drained without inference
+        size_t count = write_failed ? 0 : in.bytes / (length * sizeof(float));
+        trailing = in.bytes % (length * sizeof(float));
+        last = in.bytes < block_bytes;
 
-        // Weights
-        float *data = it->second.data<float>();
-        for (size_t offset = 0; offset < it->second.shape[1]; offset += core)
+        out.buffer->clear();
+        for (size_t r = 0; r < count; r++)
         {
-            size_t range = std::min(std::min(core, it->second.shape[1]), it->second.shape[1] - offset);
-            for (size_t node = 0; node < it->second.shape[0]; node++)
+            const float *row = in.buffer->data() + r * length;
+            if (constant_input)
             {
-                for (size_t i = 0; i < range; i++)
-                {
-                    weight->writeSourceFloat(data[node * it->second.shape[1] + offset + i]);
-                }
+                std::copy(row, row + length, staged.begin());
+                row = staged.data();
             }
+            inference += session.run(row, length + constant_input, *out.buffer);
+            failed += session.hasFailed();
+        }
+        out.bytes = out.buffer->size() * sizeof(float);
+        rows += count;
+
+        free_inputs.push(in);
+        if (out.bytes > 0)
+            computed_outputs.push(out);
+        else
+            free_outputs.push(out);
+    }
+    computed_outputs.push({NULL, 0});
+    reader.join();
+    writer.join();
+    double seconds = timer.elapsed(start, timer.now()) / 1e9;
+
+    std::cerr << "Pipe: " << rows << " rows in " << seconds << " s, " << rows / seconds << " rows/s, "
+              << rows * length * sizeof(float) / seconds / 1e6 << " MB/s in, " << rows * outputs * sizeof(float) / seconds / 1e6
+              << " MB/s out, inference " << (rows > 0 ? inference / 1000.0 / rows : 0) << " us/row" << std::endl;
+    if (trailing > 0)
+        std::cerr << "Pipe: ignored " << trailing << " trailing bytes, not a whole row of " << length << " floats" << std::endl;
+    if (failed > 0)
+        std::cerr << "Pipe: DMA failures on " << failed << " rows, their outputs are NaN" << std::endl;
+    if (write_failed)
+        std::cerr << "Pipe: output closed early" << std::endl;
+}
+
+// Execution configuration compared in A/B mode
+struct ExecutionConfig
+{
+    std::string description;
+    NpuSession::WaitPolicy wait;
+    size_t model;
+};
+
+// Parse "wait=spin|yield,core=N"; a core count loads another tiling of the layers
+ExecutionConfig parse_execution_config(const std::string &spec, NpuSession &session, cnpy::npz_t &layers, size_t model)
+{
+    ExecutionConfig config = {spec.empty() ? "default" : spec, NpuSession::Spin, model};
+    std::stringstream list(spec);
+    for (std::string setting; std::getline(list, setting, ',');)
+    {
+        std::string key = setting.substr(0, setting.find('='));
+        std::string value = setting.find('=') == std::string::npos ? "" : setting.substr(setting.find('=') + 1);
+        if (key == "wait" && (value == "spin" || value == "yield"))
+        {
+            config.wait = value == "spin" ? NpuSession::Spin : NpuSession::Yield;
+        }
+        else if (key == "core" && !value.empty())
+        {
+            config.model = load_or_exit(session, layers, "the " + value + "-core tiling", std::stoul(value));
+        }
+        else
+        {
+            std::cout << "Unknown execution setting \"" << setting << "\"" << std::endl;
+            exit(1);
         }
     }
+    return config;
+}
 
-    // Reset destination
-    memset((void *)io->getDestinationAddress(), 0, dst_length * 4);
+// Run the dataset rows as steps of `streams` interleaved sequences (row n feeds
+// stream n % streams) through a recurrent model taking [state | x] and producing
+// [state | y], once with the state kept in the io window and once with the state
+// copied through the host, and compare step latencies. A step the DMA failed on is
+// not timed and leaves the state of its stream as it was.
+void run_recurrent(NpuSession &session, const Timer &timer, const Dataset &dataset, size_t streams, size_t state)
+{
+    size_t samples = dataset.samples;
+    size_t row_length = dataset.row_length;
+    size_t input_length = session.getInputLength(), x_length = input_length - state;
 
-    if (verbosity_level > 1)
+    if (state >= input_length || state > session.getOutputLength() || x_length > row_length)
+    {
+        std::cout << "The model cannot take a state of " << state << " floats with rows of " << row_length << " floats" << std::endl;
+        exit(1);
+    }
+    if (!session.reserveStreams(streams, state))
     {
-        std::cout << "Loading " << (weight->getCursor() / 4) << " weights" << std::endl;
-        std::cout << "Loading " << (config->getCursor() / 8) << " instructions" << std::endl;
+        std::cout << "Unable to reserve " << streams << " stream slots in the io window (needs --simulate or --relaxed-mmio)" << std::endl;
+        exit(1);
     }
 
-    for (size_t n = 0; n < dataset["x"].shape[0]; n++)
+    tqdm bar;
+    std::vector<float> results, staged(input_length);
+    std::vector<std::vector<float>> host_state(streams, std::vector<float>(state, 0));
+    std::vector<double> latencies[2];
+    size_t failed[2] = {0, 0};
+
+    for (size_t n = 0; n < samples; n++)
     {
+        bar.progress(n, samples);
+        size_t stream = n % streams;
+        const float *x = dataset.row(n);
 
-        if (verbosity_level == 0)
+        // State kept in the io window
+        uint64_t start = timer.now();
+        session.step(stream, x, x_length, results);
+        if (session.hasFailed())
+            failed[0]++;
+        else
+            latencies[0].push_back(timer.elapsed(start, timer.now()) / 1000.0);
+        results.clear();
+
+        // State read from io_dst and staged back with the next input
+        start = timer.now();
+        std::copy(host_state[stream].begin(), host_state[stream].end(), staged.begin());
+        std::copy(x, x + x_length, staged.begin() + state);
+        session.run(staged.data(), input_length, results);
+        if (session.hasFailed())
+        {
+            failed[1]++;
+        }
+        else
         {
-            bar.progress(n, dataset["x"].shape[0]);
+            std::copy(results.begin(), results.begin() + state, host_state[stream].begin());
+            latencies[1].push_back(timer.elapsed(start, timer.now()) / 1000.0);
         }
+        results.clear();
+    }
+    bar.finish();
+
+    // Both ways must have carried the same state
+    float difference = 0;
+    std::vector<float> device_state;
+    for (size_t stream = 0; stream < streams; stream++)
+    {
+        session.getStreamState(stream, device_state);
+        for (size_t i = 0; i < state; i++)
+            difference = std::max(difference, std::abs(device_state[i] - host_state[stream][i]));
+    }
 
-        io->resetCursor();
-        // Inputs
-        for (size_t i = 0; i < dataset["x"].shape[1]; i++)
+    std::cout << samples << " steps over " << streams << " streams, state of " << state << " floats" << std::endl;
+    const char *ways[] = {"State in io window", "Host round-trip"};
+    for (size_t w = 0; w < 2; w++)
+    {
+        std::cout << ways[w] << ": mean " << mean(latencies[w]) << " us, p50 " << percentile(latencies[w], 50) << " us, p99 "
+                  << percentile(latencies[w], 99) << " us per step" << std::endl;
+    }
+    std::cout << "Speedup: x" << mean(latencies[1]) / mean(latencies[0]) << ", largest state difference " << difference << std::endl;
+    if (failed[0] + failed[1] > 0)
+    {
+        std::cout << "DMA failures: " << failed[0] << " steps in io window, " << failed[1]
+                  << " host round-trips not timed, the states differ from there" << std::endl;
+    }
+}
+
+// Run the dataset in batches, once with one instruction stream per batch and once
+// sending the instructions for every sample, and compare config-channel bytes and
+// time per sample. Samples the DMA failed on either way are not scored.
+void run_batched(NpuSession &session, const Dataset &dataset, size_t batch)
+{
+    size_t samples = dataset.samples;
+    size_t row_length = dataset.row_length;
+    size_t outputs = session.getOutputLength();
+    const char *output = dataset.labels;
+
+    if (!session.supportsBatch())
+    {
+        std::cout << "The NPU does not decode the batch header, instructions are sent for every sample" << std::endl;
+    }
+
+    tqdm bar;
+    std::vector<float> batched, single;
+    unsigned long config_bytes[2] = {0, 0};
+    uint64_t time[2] = {0, 0};
+    size_t correct_classification = 0, mismatches = 0, failed = 0;
+
+    for (size_t begin = 0; begin < samples; begin += batch)
+    {
+        bar.progress(begin, samples);
+        size_t count = std::min(batch, samples - begin);
+        unsigned long bytes;
+        batched.clear();
+        time[0] += session.runBatch(dataset.row(begin), count, row_length, dataset.stride, batched, bytes);
+        config_bytes[0] += bytes;
+        bool batch_failed = session.hasFailed();
+
+        for (size_t n = 0; n < count; n++)
         {
-            io->writeSourceFloat(input[n * dataset["x"].shape[1] + i]);
+            single.clear();
+            time[1] += session.run(dataset.row(begin + n), row_length, single);
+            config_bytes[1] += session.getConfigLength();
+
+            // The outputs of a failed sample in a batch are NaN
+            const float *sample = &batched[n * outputs];
+            if (session.hasFailed() || (batch_failed && std::isnan(sample[0])))
+            {
+                failed++;
+                continue;
+            }
+            if ((int)argmax(sample, outputs) == (int)output[begin + n])
+                correct_classification++;
+            if (!std::equal(single.begin(), single.end(), sample))
+                mismatches++;
         }
+    }
+    bar.finish();
 
-        if (verbosity_level > 1)
+    const char *ways[] = {"Batch instruction stream", "Instructions per sample"};
+    for (size_t w = 0; w < 2; w++)
+    {
+        std::cout << ways[w] << ": " << (float)config_bytes[w] / (float)samples << " config bytes/sample, "
+                  << time[w] / 1000.0 / samples << " us/sample" << std::endl;
+    }
+    std::cout << "Batches of " << batch << ": config bytes x" << (float)config_bytes[1] / (float)config_bytes[0]
+              << " lower, overhead " << (time[1] > time[0] ? (time[1] - time[0]) / 1000.0 / samples : 0) << " us/sample saved" << std::endl;
+    std::cout << "Accuracy: " << (float)correct_classification / (float)(samples - failed) * 100 << "%, " << mismatches << " samples differ from single runs" << std::endl;
+    if (failed > 0)
+        std::cout << "DMA failures: " << failed << " samples not scored" << std::endl;
+}
+
+// Load the archives with their pages dropped from the page cache, through cnpy and
+// through the read-ahead reader, alternating which goes first every round
+void run_cold_start(const Timer &timer, const std::vector<std::string> &files, size_t rounds)
+{
+    uint64_t bytes = 0;
+    for (const std::string &file : files)
+    {
+        struct stat status;
+        if (stat(file.c_str(), &status) == 0)
+            bytes += status.st_size;
+    }
+
+    bool dropped = true;
+    std::vector<double> times[2];
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (size_t k = 0; k < 2; k++)
         {
-            std::cout << "Loading " << (io->getCursor() / 4) << " inputs" << std::endl;
+            size_t way = (r + k) % 2;
+            for (const std::string &file : files)
+                dropped = drop_cached_pages(file) && dropped;
+
+            uint64_t start = timer.now();
+            for (const std::string &file : files)
+                load_npz(file, way == 1);
+            times[way].push_back(timer.elapsed(start, timer.now()) / 1e6);
         }
+    }
 
-        auto start = std::chrono::high_resolution_clock::now();
+    if (!dropped)
+        std::cout << "Unable to drop the files from the page cache, loads may be warm" << std::endl;
+    const char *ways[] = {"cnpy::npz_load", "Read-ahead reader"};
+    for (size_t w = 0; w < 2; w++)
+    {
+        std::cout << ways[w] << (w == 1 ? std::string(" (") + FileReader(files[0]).getBackend() + ")" : std::string()) << ": median "
+                  << percentile(times[w], 50) << " ms, " << bytes / percentile(times[w], 50) / 1000 << " MB/s over " << rounds << " cold loads of "
+                  << bytes << " bytes" << std::endl;
+    }
+}
 
-        // Init
-        config->reset();
-        config->halt();
-        config->setInterrupt(true, true, 0);
-        config->ready();
+// Report what the graph optimizer removed, then run the dataset through the
+// original and the optimized model alternately and compare latency and top-1
+// (skipped without a session)
+void report_graph_optimization(NpuSession *session, const Dataset &dataset, const GraphOptimization &optimization, size_t original, size_t optimized)
+{
+    size_t samples = dataset.samples;
+    size_t row_length = dataset.row_length;
 
-        weight->reset();
-        weight->halt();
-        weight->setInterrupt(true, true, 0);
-        weight->ready();
+    std::cout << "Graph optimizer: " << optimization.fused << " linear layers fused, final softmax "
+              << (optimization.softmax_dropped ? "dropped" : "kept") << std::endl;
+    const GraphCost *costs[] = {&optimization.before, &optimization.after};
+    const char *names[] = {"Before", "After"};
+    for (size_t c = 0; c < 2; c++)
+    {
+        std::cout << names[c] << ": " << costs[c]->layers << " layers, " << costs[c]->macs << " MACs, "
+                  << costs[c]->weight_bytes << " weight bytes" << std::endl;
+    }
 
-        io->reset();
-        io->halt();
-        io->setInterrupt(true, true, 0);
-        io->ready();
+    if (session == NULL || samples == 0)
+        return;
 
-        // Listen
-        io->setDestinationAddress(io_dst.addr);
-        io->setDestinationLength(dst_length * 4);
+    // Warm both models up, then swap which runs first every sample so neither
+    // always finds the row in cache
+    std::vector<float> results[2];
+    size_t models[2] = {original, optimized};
+    for (size_t m = 0; m < 2; m++)
+        session->run(dataset.row(0), row_length, results[m], models[m]);
 
-        // Send instructions
-        config->setSourceAddress(config_src.addr);
-        config->setSourceLength(config->getCursor());
-        if (verbosity_level > 1)
+    // A sample the DMA failed on with either model is left out
+    uint64_t time[2] = {0, 0};
+    size_t agreements = 0, failed = 0;
+    for (size_t n = 0; n < samples; n++)
+    {
+        uint64_t sample_time[2];
+        bool sample_failed = false;
+        for (size_t k = 0; k < 2; k++)
         {
-            std::cout << "Waiting for Instructions MM2S..." << std::endl;
+            size_t m = (n % 2) ^ k;
+            results[m].clear();
+            sample_time[m] = session->run(dataset.row(n), row_length, results[m], models[m]);
+            sample_failed = sample_failed || session->hasFailed();
         }
-        mem_status = -1;
-        do
+        if (sample_failed)
         {
-            status = config->getMM2SStatus();
-            if (verbosity_level > 1)
-            {
-                if (mem_status != status)
-                    config->dumpStatus(status);
-                mem_status = status;
-            }
-        } while (
-            !(status & 1 << 0) &&
-            !(status & 1 << 1) &&
-            !(status & 1 << 4) &&
-            !(status & 1 << 12) &&
-            !(status & 1 << 14));
-
-        // Send input
-        io->setSourceAddress(io_src.addr);
-        io->setSourceLength(io->getCursor());
-        if (verbosity_level > 1)
+            failed++;
+            continue;
+        }
+        time[0] += sample_time[0];
+        time[1] += sample_time[1];
+        if (argmax(results[0]) == argmax(results[1]))
+            agreements++;
+    }
+    size_t scored = std::max<size_t>(samples - failed, 1);
+    std::cout << "Latency: " << time[0] / 1000.0 / scored << " us before, " << time[1] / 1000.0 / scored << " us after (x"
+              << (double)time[0] / std::max<uint64_t>(time[1], 1) << "), top-1 agreement " << (float)agreements / (float)scored * 100 << "%" << std::endl;
+    if (failed > 0)
+        std::cout << "DMA failures: " << failed << " samples not compared" << std::endl;
+}
+
+// Swap the weights of a resident model for another version of the same layers,
+// rewriting only the tiles that changed, and compare with rewriting all of them.
+// If the weights cannot be updated in place the model is reloaded under its index.
+// Returns false if the session still runs the old model.
+bool swap_weights(NpuSession &session, const Timer &timer, size_t model, cnpy::npz_t &layers)
+{
+    WeightUpdate delta, full;
+    if (!session.update(model, layers, delta))
+    {
+        std::cout << "Weights cannot be updated in place (layers differ or the weight window is not mapped), reloading" << std::endl;
+        uint64_t start = timer.now();
+        if (!session.replace(model, layers))
         {
-            std::cout << "Waiting for IO MM2S..." << std::endl;
+            std::cout << "No room left for the new model in the source windows, keeping the old one" << std::endl;
+            return false;
         }
-        mem_status = -1;
-        do
+        std::cout << "Full reload: " << timer.elapsed(start, timer.now()) / 1000.0 << " us" << std::endl;
+        return true;
+    }
+    session.update(model, layers, full, true);
+
+    std::cout << "Delta upload: " << delta.changed_tiles << "/" << delta.tiles << " tiles, " << delta.bytes_written << "/" << delta.bytes_total
+              << " bytes written (" << (float)(delta.bytes_total - delta.bytes_written) / (float)delta.bytes_total * 100 << "% saved), "
+              << delta.time / 1000.0 << " us" << std::endl;
+    std::cout << "Full upload: " << full.bytes_written << " bytes written, " << full.time / 1000.0 << " us ("
+              << (double)full.time / std::max<uint64_t>(delta.time, 1) << "x the delta upload)" << std::endl;
+    return true;
+}
+
+// Compare channel programming and input staging through DirectMemoryAccess with
+// the relaxed MMIO path, the burst copy kernel and the io_src mappings, for rows
+// of the dataset length
+void run_mmio_benchmark(NpuSession &session, const Dataset &dataset, size_t iterations)
+{
+    size_t row_length = dataset.row_length;
+    if (!session.setRelaxedMmio(true))
+    {
+        std::cout << "Unable to map the DMA registers and the io window through /dev/mem" << std::endl;
+        exit(1);
+    }
+
+    MmioBenchmark benchmark = session.benchmarkMmio(iterations, row_length);
+    std::cout << "Programming: DirectMemoryAccess " << benchmark.programming[0] << " ns, relaxed MMIO " << benchmark.programming[1]
+              << " ns per sample (x" << benchmark.programming[0] / benchmark.programming[1] << ")" << std::endl;
+
+    const char *kernels[] = {"writeSourceFloat", "relaxed per-float stores", "stream_copy"};
+    for (size_t k = 0; k < 3; k++)
+    {
+        std::cout << "Staging " << row_length * 4 << " bytes, " << kernels[k] << ": " << benchmark.staging[k] << " ns ("
+                  << row_length * 4 / benchmark.staging[k] * 1000 << " MB/s, x" << benchmark.staging[0] / benchmark.staging[k] << ")" << std::endl;
+    }
+
+    for (size_t m = 0; m < 3; m++)
+    {
+        std::cout << "Staging " << row_length * 4 << " bytes, stream_copy to " << DmaBuffer::getName((DmaBuffer::Mapping)m) << " io_src: ";
+        if (benchmark.mapping[m] > 0)
+            std::cout << benchmark.mapping[m] << " ns (" << row_length * 4 / benchmark.mapping[m] * 1000 << " MB/s)" << std::endl;
+        else
+            std::cout << "mapping unavailable" << std::endl;
+    }
+}
+
+// Run every sample under both configurations, alternating their order every
+// block of samples so drift affects both equally, and report paired differences.
+// A sample the DMA failed on under either configuration is left out of both.
+void run_ab(NpuSession &session, const ExecutionConfig configs[2], const Dataset &dataset, size_t block)
+{
+    size_t samples = dataset.samples;
+    size_t row_length = dataset.row_length;
+    const char *output = dataset.labels;
+
+    tqdm bar;
+    std::vector<float> results;
+    std::vector<double> sample_latencies[2], latencies[2], differences;
+    std::vector<bool> correct[2], failed(samples, false);
+    size_t correct_classification[2] = {0, 0};
+    for (size_t c = 0; c < 2; c++)
+    {
+        sample_latencies[c].resize(samples);
+        correct[c].resize(samples);
+    }
+
+    for (size_t begin = 0; begin < samples; begin += block)
+    {
+        bar.progress(begin, samples);
+        size_t end = std::min(begin + block, samples);
+        size_t first = (begin / block) % 2;
+
+        for (size_t k = 0; k < 2; k++)
         {
-            status = io->getMM2SStatus();
-            if (verbosity_level > 1)
+            size_t c = first ^ k;
+            session.setWaitPolicy(configs[c].wait);
+            for (size_t n = begin; n < end; n++)
             {
-                if (mem_status != status)
-                    io->dumpStatus(status);
-                mem_status = status;
+                sample_latencies[c][n] = session.run(dataset.row(n), row_length, results, configs[c].model) / 1000.0;
+                failed[n] = failed[n] || session.hasFailed();
+                correct[c][n] = (int)argmax(results) == (int)output[n];
+                results.clear();
             }
-        } while (
-            !(status & 1 << 0) &&
-            !(status & 1 << 1) &&
-            !(status & 1 << 4) &&
-            !(status & 1 << 12) &&
-            !(status & 1 << 14));
-
-        // Send weights
-        weight->setSourceAddress(weight_src.addr);
-        weight->setSourceLength(weight->getCursor());
-        if (verbosity_level > 1)
+        }
+    }
+    bar.finish();
+
+    size_t scored = 0;
+    for (size_t n = 0; n < samples; n++)
+    {
+        if (failed[n])
+            continue;
+        scored++;
+        for (size_t c = 0; c < 2; c++)
         {
-            std::cout << "Waiting for Weights MM2S..." << std::endl;
+            latencies[c].push_back(sample_latencies[c][n]);
+            correct_classification[c] += correct[c][n];
         }
-        mem_status = -1;
-        do
+        differences.push_back(sample_latencies[1][n] - sample_latencies[0][n]);
+    }
+
+    for (size_t c = 0; c < 2; c++)
+    {
+        std::cout << "[" << (c == 0 ? "A" : "B") << "] " << configs[c].description
+                  << ": mean " << mean(latencies[c]) << " us, p50 " << percentile(latencies[c], 50) << " us, p99 " << percentile(latencies[c], 99) << " us"
+                  << ", accuracy " << (float)correct_classification[c] / (float)scored * 100 << "%" << std::endl;
+    }
+    if (scored < samples)
+        std::cout << "DMA failures: " << samples - scored << " samples not scored" << std::endl;
+    double delta = mean(differences), interval = confidence95(differences);
+    std::cout << "B - A: " << delta << " us (95% CI " << delta - interval << " .. " << delta + interval << " us), "
+              << delta / mean(latencies[0]) * 100 << "%, median " << percentile(differences, 50) << " us" << std::endl;
+    std::cout << "Difference is " << (delta - interval > 0 || delta + interval < 0 ? "significant" : "not significant") << " at 95%" << std::endl;
+}
+
+// Serve a bulk re-scoring job (every dataset row, queued at once) while interactive
+// requests arrive at a fixed mean rate, and report latency percentiles per class.
+// Requests the DMA failed on are counted apart.
+void run_mixed_workload(NpuSession &session, const Dataset &dataset, double interactive_share, double interactive_rate, size_t deadline, size_t aging)
+{
+    const unsigned int interactive = 0, bulk = 1;
+    const char *class_names[] = {"interactive", "bulk"};
+    size_t samples = dataset.samples;
+    size_t row_length = dataset.row_length;
+    const char *output = dataset.labels;
+
+    RequestScheduler scheduler(aging);
+    std::vector<InferenceRequest> arrivals;
+    std::vector<float> results;
+    std::vector<double> latencies[2];
+    size_t correct_classification[2] = {0, 0}, deadline_misses[2] = {0, 0}, failed[2] = {0, 0};
+    size_t id = 0;
+
+    auto begin = scheduler_clock::now();
+    for (size_t n = 0; n < samples; n++)
+    {
+        scheduler.submit({id++, n, bulk, false, scheduler_clock::time_point(), begin});
+    }
+
+    // Poisson arrivals of interactive requests on random rows
+    std::mt19937 generator(0);
+    std::exponential_distribution<double> inter_arrival(interactive_rate);
+    std::uniform_int_distribution<size_t> row(0, samples - 1);
+    auto arrival = begin;
+    for (size_t i = 0; i < (size_t)(samples * interactive_share); i++)
+    {
+        arrival += std::chrono::duration_cast<scheduler_clock::duration>(std::chrono::duration<double>(inter_arrival(generator)));
+        arrivals.push_back({id++, row(generator), interactive, deadline > 0, arrival + std::chrono::microseconds(deadline), arrival});
+    }
+
+    size_t next_arrival = 0;
+    while (!scheduler.empty() || next_arrival < arrivals.size())
+    {
+        auto now = scheduler_clock::now();
+        while (next_arrival < arrivals.size() && arrivals[next_arrival].arrival <= now)
         {
-            status = weight->getMM2SStatus();
-            if (verbosity_level > 1)
-            {
-                if (mem_status != status)
-                    weight->dumpStatus(status);
-                mem_status = status;
-            }
-        } while (
-            !(status & 1 << 0) &&
-            !(status & 1 << 1) &&
-            !(status & 1 << 4) &&
-            !(status & 1 << 12) &&
-            !(status & 1 << 14));
-
-        // Wait for output
-        if (verbosity_level > 1)
+            scheduler.submit(arrivals[next_arrival++]);
+        }
+        if (scheduler.empty())
         {
-            std::cout << "Waiting for IO S2MM..." << std::endl;
+            std::this_thread::sleep_until(arrivals[next_arrival].arrival);
+            continue;
         }
-        mem_status = -1;
-        do
+
+        InferenceRequest request = scheduler.next(now);
+        session.run(dataset.row(request.sample), row_length, results);
+        auto done = scheduler_clock::now();
+        if (session.hasFailed())
         {
-            status = io->getS2MMStatus();
-            if (verbosity_level > 1)
+            failed[request.priority]++;
+            results.clear();
+            continue;
+        }
+
+        latencies[request.priority].push_back(std::chrono::duration<double, std::micro>(done - request.arrival).count());
+        if (request.has_deadline && done > request.deadline)
+            deadline_misses[request.priority]++;
+        if ((int)argmax(results) == (int)output[request.sample])
+            correct_classification[request.priority]++;
+
+        results.clear();
+    }
+    auto end = scheduler_clock::now();
+
+    for (unsigned int c = interactive; c <= bulk; c++)
+    {
+        std::vector<double> &l = latencies[c];
+        std::cout << "[" << class_names[c] << "] Requests: " << l.size() << ", accuracy: " << (l.empty() ? 0 : (float)correct_classification[c] / (float)l.size() * 100) << "%" << std::endl;
+        std::cout << "[" << class_names[c] << "] Latency p50: " << percentile(l, 50) << " us, p95: " << percentile(l, 95) << " us, p99: " << percentile(l, 99) << " us, max: " << percentile(l, 100) << " us" << std::endl;
+        std::cout << "[" << class_names[c] << "] Deadline misses: " << deadline_misses[c] << std::endl;
+        if (failed[c] > 0)
+            std::cout << "[" << class_names[c] << "] DMA failures: " << failed[c] << " requests not scored" << std::endl;
+    }
+    std::cout << "Aging promotions: " << scheduler.getPromotions() << std::endl;
+    std::cout << "Throughput: " << (double)id / std::chrono::duration<double>(end - begin).count() << " samples/s" << std::endl;
+}
+
+// Run the dataset through the resident model and report accuracy and mean
+// execution time, answering repeated rows from the result cache when enabled.
+// Samples the DMA failed on are neither cached nor scored.
+void run_dataset(NpuSession &session, const Timer &timer, const Dataset &dataset, unsigned int verbosity_level, size_t cache_size, double duplicate_ratio)
+{
+    tqdm bar;
+    size_t correct_classification = 0, failed = 0;
+    uint64_t execution_time = 0, lookup_time = 0; // ns
+    std::vector<float> results;
+    const char *output = dataset.labels;
+
+    ResultCache cache(cache_size);
+    std::vector<size_t> order = sample_order(dataset.samples, duplicate_ratio);
+
+    for (size_t s = 0; s < order.size(); s++)
+    {
+        size_t n = order[s];
+
+        if (verbosity_level == 0)
+        {
+            bar.progress(s, dataset.samples);
+        }
+
+        const float *row = dataset.row(n);
+        uint64_t duration = 0;
+        uint64_t key = 0;
+        bool hit = false;
+        if (cache_size > 0)
+        {
+            uint64_t start = timer.now();
+            key = ResultCache::key(row, dataset.row_length, session.getModelId());
+            hit = cache.lookup(key, results);
+            lookup_time += timer.elapsed(start, timer.now());
+        }
+        if (!hit)
+        {
+            duration = session.run(row, dataset.row_length, results);
+            if (session.hasFailed())
             {
-                if (mem_status != status)
-                    io->dumpStatus(status);
-                mem_status = status;
+                failed++;
+                results.clear();
+                continue;
             }
-        } while (
-            !(status & 1 << 0) &&
-            !(status & 1 << 1) &&
-            !(status & 1 << 4) &&
-            !(status & 1 << 12) &&
-            !(status & 1 << 14));
-
-        auto stop = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
-        execution_time += duration.count();
+            cache.insert(key, results, duration / 1000.0);
+        }
+        execution_time += duration;
 
         if (verbosity_level > 0)
         {
-            std::cout << "Execution time: " << duration.count() << " us" << std::endl;
+            std::cout << "Execution time: " << duration / 1000.0 << " us" << std::endl;
         }
 
-        // Extract results
-        float *fp = (float *)io->getDestinationAddress();
-        for (int i = 0; i < dst_length; i++)
-            results.push_back(fp[i]);
-
         // Determine accuracy
-        int maxElementIndex = std::max_element(results.begin(), results.end()) - results.begin();
+        int maxElementIndex = argmax(results);
         if (maxElementIndex == (int)output[n])
             correct_classification++;
 
         if (verbosity_level > 1)
         {
             std::cout << "Result:" << std::endl;
-            for (int i = 0; i < dst_length; i++)
+            for (size_t i = 0; i < results.size(); i++)
                 std::cout << "\t" << results[i] << std::endl;
             if (maxElementIndex == (int)output[n])
             {
@@ -295,8 +1019,412 @@ int main(int argc, char *argv[])
         bar.finish();
     }
 
-    std::cout << "Accuracy: " << (float)correct_classification / (float)dataset["x"].shape[0] * 100 << "%" << std::endl;
-    std::cout << "Mean execution time: " << (float)execution_time / (float)dataset["x"].shape[0] << " us" << std::endl;
+    size_t scored = order.size() - failed;
+    std::cout << "Accuracy: " << (float)correct_classification / (float)scored * 100 << "%" << std::endl;
+    std::cout << "Mean execution time: " << execution_time / 1000.0 / scored << " us" << std::endl;
+    if (failed > 0)
+        std::cout << "DMA failures: " << failed << " samples not scored" << std::endl;
+
+    if (cache_size > 0)
+    {
+        std::cout << "Cache hit rate: " << (float)cache.getHits() / (float)order.size() * 100 << "% (" << cache.getHits() << " hits, " << cache.getMisses() << " misses)" << std::endl;
+        std::cout << "Cache memory: " << cache.getMemory() << " bytes for " << cache.getSize() << " entries" << std::endl;
+        std::cout << "Latency saved: " << cache.getSavedTime() - lookup_time / 1000.0 << " us (" << lookup_time / 1000.0 << " us spent in lookups)" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    cxxopts::Options options("npu_tester", "Software to test NPU with different neural network architectures and datasets");
+    options.add_options()
+        ("v,verbose", "Verbose output", cxxopts::value<bool>()->default_value("false"))
+        ("c,core", "Number of core in the NPU (REQUIRED)", cxxopts::value<int>())
+        ("d,dir", "Directory in which are layers.npz and datasets.npz files (REQUIRED)", cxxopts::value<std::string>())
+        ("mixed", "Benchmark a mixed interactive/bulk workload through the request scheduler", cxxopts::value<bool>()->default_value("false"))
+        ("interactive-share", "Interactive requests per dataset row in mixed mode", cxxopts::value<double>()->default_value("0.1"))
+        ("interactive-rate", "Mean arrival rate of interactive requests in mixed mode (requests/s)", cxxopts::value<double>()->default_value("200"))
+        ("deadline", "Deadline of interactive requests in mixed mode (us, 0 for none)", cxxopts::value<size_t>()->default_value("5000"))
+        ("aging", "Waiting time after which a request is promoted one priority class (us, 0 disables)", cxxopts::value<size_t>()->default_value("20000"))
+        ("cache", "Entries of the LRU result cache consulted before staging inputs (0 disables)", cxxopts::value<size_t>()->default_value("0"))
+        ("duplicate-ratio", "Fraction of dataset requests that repeat an earlier row", cxxopts::value<double>()->default_value("0"))
+        ("cascade", "layers.npz of a large model to escalate to when the model of --dir is not confident", cxxopts::value<std::string>())
+        ("thresholds", "Comma-separated confidence thresholds swept in cascade mode", cxxopts::value<std::string>()->default_value("0.5,0.6,0.7,0.8,0.9,0.95,0.99"))
+        ("processes", "Evaluate the dataset with up to this many forked simulator (or CPU model) processes and report the scaling, without opening the board (0 disables)", cxxopts::value<size_t>()->default_value("0"))
+        ("cpu-workers", "CPU worker threads stealing dataset rows from the NPU (0 disables)", cxxopts::value<size_t>()->default_value("0"))
+        ("power", "Sample hwmon power rails and report energy per phase and per inference", cxxopts::value<bool>()->default_value("false"))
+        ("hwmon-root", "Directory holding the hwmon devices", cxxopts::value<std::string>()->default_value("/sys/class/hwmon"))
+        ("power-period", "Power sampling period (ms)", cxxopts::value<size_t>()->default_value("10"))
+        ("idle-time", "Idle power measurement before loading (ms)", cxxopts::value<size_t>()->default_value("1000"))
+        ("system-state", "Record cpufreq and thermal state before, during and after the run", cxxopts::value<bool>()->default_value("false"))
+        ("sysfs-root", "Root of the sysfs tree holding cpufreq and thermal zones", cxxopts::value<std::string>()->default_value("/sys"))
+        ("state-period", "cpufreq and thermal sampling period (ms)", cxxopts::value<size_t>()->default_value("100"))
+        ("lock-governor", "Set the cpufreq governor to performance for the duration of the run", cxxopts::value<bool>()->default_value("false"))
+        ("clock", "Clock used for latencies: steady, monotonic-raw or counter (ARM generic timer / TSC)", cxxopts::value<std::string>()->default_value("steady"))
+        ("ab-a", "Execution configuration A for interleaved A/B mode (e.g. \"wait=spin,core=4\")", cxxopts::value<std::string>())
+        ("ab-b", "Execution configuration B for interleaved A/B mode (e.g. \"wait=yield\")", cxxopts::value<std::string>())
+        ("ab-block", "Samples run under one configuration before switching in A/B mode", cxxopts::value<size_t>()->default_value("1"))
+        ("simulate", "Run the model on the multi-threaded NPU simulator instead of the board", cxxopts::value<bool>()->default_value("false"))
+        ("sim-threads", "Host threads of the simulator (0 for one per CPU)", cxxopts::value<size_t>()->default_value("0"))
+        ("fixed-point", "Simulate a fixed-point datapath, e.g. \"16.8,round=nearest,overflow=saturate,acc=32,sigmoid=piecewise\"", cxxopts::value<std::string>())
+        ("update", "layers.npz of a new version of the model, swapped in place by uploading only the tiles that changed", cxxopts::value<std::string>())
+        ("recurrent", "Run the dataset as interleaved sequences through a recurrent model with this many state floats at the start of its input and output (0 disables)", cxxopts::value<size_t>()->default_value("0"))
+        ("streams", "Interleaved sequences in recurrent mode", cxxopts::value<size_t>()->default_value("4"))
+        ("batch", "Compare batches driven by one instruction stream with the instructions sent per sample (samples per batch, 0 disables)", cxxopts::value<size_t>()->default_value("0"))
+        ("prune", "Remove hidden neurons with all-zero incoming or outgoing weights, reporting the weights and MACs eliminated", cxxopts::value<bool>()->default_value("false"))
+        ("optimize", "Fuse layers without activation and drop a final softmax when only the output ranking is used, reporting the savings", cxxopts::value<bool>()->default_value("false"))
+        ("normalize", "Input normalization folded into the first layer: \"MEAN,STD\" or an npz holding mean and std arrays", cxxopts::value<std::string>())
+        ("dataset-cache", "Map the dataset from dataset.npu, converted from dataset.npz on the first run and again when its size or mtime change (rows padded to 64 bytes)", cxxopts::value<bool>()->default_value("false"))
+        ("dataset-verify", "Hash the whole dataset.npu against its header before using it, timed apart from the mapping", cxxopts::value<bool>()->default_value("false"))
+        ("read-ahead", "Load the npz files through the read-ahead reader (io_uring or pread thread) with streaming inflate", cxxopts::value<bool>()->default_value("false"))
+        ("cold-start", "Compare cold loads of the npz files through cnpy and the read-ahead reader (rounds, 0 disables)", cxxopts::value<size_t>()->default_value("0"))
+        ("relaxed-mmio", "Program the DMA registers and stage inputs through relaxed MMIO with one barrier per doorbell", cxxopts::value<bool>()->default_value("false"))
+        ("source-mapping", "Mapping of the DMA source windows on the relaxed MMIO path: uncached, wc (write-combined) or cached (flushed before transfers); wc and cached need u-dma-buf", cxxopts::value<std::string>()->default_value("uncached"))
+        ("dma-retries", "Attempts after the first when a DMA channel reports an error or stays in reset, the channels being reset before each", cxxopts::value<size_t>()->default_value("3"))
+        ("mmio-bench", "Benchmark channel programming and input staging with and without relaxed MMIO (iterations, 0 disables)", cxxopts::value<size_t>()->default_value("0"))
+        ("pipe", "Read float32 rows of the model input length from stdin, write the float32 outputs to stdout; reports go to stderr", cxxopts::value<bool>()->default_value("false"))
+        ("pipe-input", "FIFO or file read instead of stdin in pipe mode", cxxopts::value<std::string>())
+        ("h,help", "Print usage")
+    ;
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || result.count("dir") == 0 || result.count("core") == 0)
+    {
+      std::cout << options.help() << std::endl;
+      exit(0);
+    }
+
+    // stdout carries the outputs in pipe mode; a reader closing it early makes
+    // writes fail with EPIPE instead of killing the process before the reports
+    bool pipe_mode = result["pipe"].as<bool>();
+    if (pipe_mode)
+    {
+        std::cout.rdbuf(std::cerr.rdbuf());
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    unsigned int verbosity_level = result.count("verbose");
+    std::string dir = result["dir"].as<std::string>();
+    size_t core = result["core"].as<int>();
+
+    std::string layers_file("layers.npz");
+    std::string dataset_file("dataset.npz");
+    std::string dataset_cache_file("dataset.npu");
+
+    Timer::Source clock_source;
+    if (!Timer::parse(result["clock"].as<std::string>(), clock_source))
+    {
+        std::cout << "Clock \"" << result["clock"].as<std::string>() << "\" is not available on this target" << std::endl;
+        exit(1);
+    }
+    Timer timer(clock_source);
+
+    PowerMonitor *power = NULL;
+    if (result["power"].as<bool>())
+    {
+        power = new PowerMonitor(result["hwmon-root"].as<std::string>(), result["power-period"].as<size_t>());
+        if (power->getRails().empty())
+        {
+            std::cout << "No power rail found in " << result["hwmon-root"].as<std::string>() << std::endl;
+        }
+        else if (verbosity_level > 0)
+        {
+            for (const PowerRail &rail : power->getRails())
+                std::cout << "Sampling power rail " << rail.name << std::endl;
+        }
+
+        power->start("idle");
+        std::this_thread::sleep_for(std::chrono::milliseconds(result["idle-time"].as<size_t>()));
+        power->phase("load");
+    }
+
+    bool read_ahead = result["read-ahead"].as<bool>();
+    cnpy::npz_t layers = load_npz(dir + layers_file, read_ahead);
+
+    InputNormalization normalization;
+    const InputNormalization *input_normalization = NULL;
+    if (result.count("normalize"))
+    {
+        if (!parse_normalization(result["normalize"].as<std::string>(), normalization))
+        {
+            std::cout << "Invalid input normalization \"" << result["normalize"].as<std::string>() << "\"" << std::endl;
+            exit(1);
+        }
+        input_normalization = &normalization;
+    }
+    FoldReport folding;
+    layers = fold_normalization(layers, input_normalization, folding);
+    if (folding.batch_norms > 0 || folding.input)
+    {
+        std::cout << "Folded " << folding.batch_norms << " batch norms" << (folding.input ? " and the input normalization" : "")
+                  << " into the weights" << (folding.constant_input ? ", biases on a constant input" : "") << std::endl;
+    }
+
+    // The dataset with the constant input already appended when the model needs it
+    cnpy::npz_t dataset_arrays;
+    DatasetCache dataset_cache;
+    Dataset dataset = {0, 0, 0, NULL, NULL};
+    uint64_t dataset_start = timer.now();
+    uint64_t dataset_source = 0, dataset_mapped = 0, dataset_validation = 0; // ns
+    if (result["dataset-cache"].as<bool>() && !pipe_mode)
+    {
+        dataset_source = file_key(dir + dataset_file, folding.constant_input);
+        dataset_cache.open(dir + dataset_cache_file, dataset_source);
+        dataset_mapped = timer.elapsed(dataset_start, timer.now());
+        if (dataset_cache.isOpen() && result["dataset-verify"].as<bool>())
+        {
+            uint64_t start = timer.now();
+            if (!dataset_cache.verify())
+            {
+                std::cout << dir + dataset_cache_file << " is damaged, converting it again" << std::endl;
+                dataset_cache.close();
+            }
+            dataset_validation = timer.elapsed(start, timer.now());
+        }
+    }
+    if (pipe_mode)
+    {
+        // Rows come from the pipe
+    }
+    else if (!dataset_cache.isOpen())
+    {
+        dataset_arrays = load_npz(dir + dataset_file, read_ahead);
+        if (folding.constant_input)
+            dataset_arrays["x"] = append_constant_input(dataset_arrays["x"]);
+        dataset = dataset_view(dataset_arrays);
+        if (result["dataset-cache"].as<bool>())
+        {
+            if (DatasetCache::write(dir + dataset_cache_file, dataset, dataset_source) && dataset_cache.open(dir + dataset_cache_file, dataset_source))
+                std::cout << "Dataset converted to " << dir + dataset_cache_file << " in " << timer.elapsed(dataset_start, timer.now()) / 1e6 << " ms" << std::endl;
+            else
+                std::cout << "Unable to write " << dir + dataset_cache_file << ", using " << dataset_file << std::endl;
+        }
+    }
+    else
+    {
+        std::cout << "Dataset mapped from " << dir + dataset_cache_file << " in " << dataset_mapped / 1e6 << " ms";
+        if (result["dataset-verify"].as<bool>())
+            std::cout << ", content verified in " << dataset_validation / 1e6 << " ms";
+        std::cout << std::endl;
+    }
+    if (dataset_cache.isOpen())
+        dataset = dataset_cache.getDataset();
+    if (result["prune"].as<bool>())
+    {
+        PruneReport pruning;
+        layers = prune_dead_neurons(layers, pruning);
+        std::cout << "Pruning: " << pruning.neurons << " dead neurons removed, " << pruning.before.weight_bytes / 4 - pruning.after.weight_bytes / 4
+                  << " weights and " << pruning.before.macs - pruning.after.macs << " MACs per sample eliminated ("
+                  << (float)(pruning.before.macs - pruning.after.macs) / (float)pruning.before.macs * 100 << "%)" << std::endl;
+    }
+
+    // Cold loads and forked processes run without the device session; the workers
+    // build their own single-threaded simulator or CPU model
+    bool host_only = !pipe_mode && (result["cold-start"].as<size_t>() > 0 || result["processes"].as<size_t>() > 0);
+
+    NpuSimulator *simulator = NULL;
+    if (result["simulate"].as<bool>())
+    {
+        // No simulator threads in the parent of forked workers
+        size_t threads = host_only ? 1 : result["sim-threads"].as<size_t>();
+        simulator = new NpuSimulator(threads > 0 ? threads : std::thread::hardware_concurrency());
+        if (result.count("fixed-point"))
+        {
+            FixedPointFormat format;
+            std::string error;
+            if (!FixedPointFormat::parse(result["fixed-point"].as<std::string>(), format, error))
+            {
+                std::cout << "Invalid --fixed-point: " << error << std::endl;
+                exit(1);
+            }
+            simulator->setFixedPoint(format);
+        }
+    }
+
+    DmaBuffer::Mapping source_mapping;
+    if (!DmaBuffer::parse(result["source-mapping"].as<std::string>(), source_mapping))
+    {
+        std::cout << "Unknown source mapping \"" << result["source-mapping"].as<std::string>() << "\"" << std::endl;
+        exit(1);
+    }
+
+    // Cascade thresholds, recurrent state and the pipe output are values, not only their order
+    bool ranking_only = !result.count("cascade") && result["recurrent"].as<size_t>() == 0 && !pipe_mode;
+    GraphOptimization optimization;
+    cnpy::npz_t original_layers = layers;
+    if (result["optimize"].as<bool>())
+    {
+        layers = optimize_graph(layers, ranking_only, optimization);
+    }
+
+    NpuSession *session = NULL;
+    size_t model = 0, large_model = 0;
+    if (!host_only)
+    {
+        session = new NpuSession(core, verbosity_level, timer, simulator);
+        session->setRetries(result["dma-retries"].as<size_t>());
+        if ((result["relaxed-mmio"].as<bool>() || source_mapping != DmaBuffer::Uncached) && !session->setRelaxedMmio(true, source_mapping))
+        {
+            std::cout << "Unable to map the DMA registers and " << DmaBuffer::getName(source_mapping) << " windows, using DirectMemoryAccess" << std::endl;
+        }
+
+        model = load_or_exit(*session, layers, "the model");
+        large_model = model;
+        if (result["optimize"].as<bool>())
+        {
+            report_graph_optimization(session, dataset, optimization, load_or_exit(*session, original_layers, "the unoptimized model"), model);
+        }
+        if (result.count("cascade"))
+        {
+            cnpy::npz_t large_layers = load_model(result["cascade"].as<std::string>(), read_ahead, input_normalization, folding.constant_input);
+            large_model = load_or_exit(*session, large_layers, "the cascade model");
+        }
+        if (result.count("update"))
+        {
+            // Through the same passes as the model, or the shapes never match
+            cnpy::npz_t update_layers = load_model(result["update"].as<std::string>(), read_ahead, input_normalization, folding.constant_input);
+            if (result["prune"].as<bool>())
+            {
+                PruneReport update_pruning;
+                update_layers = prune_dead_neurons(update_layers, update_pruning);
+            }
+            if (result["optimize"].as<bool>())
+            {
+                GraphOptimization update_optimization;
+                update_layers = optimize_graph(update_layers, ranking_only, update_optimization);
+            }
+            if (swap_weights(*session, timer, model, update_layers))
+                layers = update_layers; // What A/B tilings and the CPU backend run from now on
+        }
+    }
+    else if (result["optimize"].as<bool>())
+    {
+        report_graph_optimization(NULL, dataset, optimization, 0, 0);
+    }
+
+    SystemMonitor *system_state = NULL;
+    if (result["system-state"].as<bool>() || result["lock-governor"].as<bool>())
+    {
+        system_state = new SystemMonitor(result["sysfs-root"].as<std::string>(), result["state-period"].as<size_t>());
+        if (result["lock-governor"].as<bool>() && !system_state->lockGovernor("performance"))
+        {
+            std::cout << "Unable to set the performance governor, running with the current one" << std::endl;
+        }
+        system_state->start();
+    }
+
+    // Inferences of the phase: samples run by the session from here, plus those
+    // computed elsewhere
+    size_t session_inferences = session != NULL ? session->getInferences() : 0, inferences = 0;
+    if (power != NULL)
+    {
+        power->phase("inference");
+    }
+
+    ExecutionConfig configs[2];
+    if (session != NULL && (result.count("ab-a") || result.count("ab-b")))
+    {
+        configs[0] = parse_execution_config(result.count("ab-a") ? result["ab-a"].as<std::string>() : "", *session, layers, model);
+        configs[1] = parse_execution_config(result.count("ab-b") ? result["ab-b"].as<std::string>() : "", *session, layers, model);
+    }
+
+    if (pipe_mode)
+    {
+        int input = 0;
+        if (result.count("pipe-input") && (input = open(result["pipe-input"].as<std::string>().c_str(), O_RDONLY)) < 0)
+        {
+            std::cout << "Unable to open " << result["pipe-input"].as<std::string>() << std::endl;
+            exit(1);
+        }
+        run_pipe(*session, timer, input, 1, session->getInputLength(model) - folding.constant_input, folding.constant_input);
+    }
+    else if (result["cold-start"].as<size_t>() > 0)
+    {
+        run_cold_start(timer, {dir + layers_file, dir + dataset_file}, result["cold-start"].as<size_t>());
+    }
+    else if (result["processes"].as<size_t>() > 0)
+    {
+        inferences = run_processes(dataset, layers, core, timer, simulator, result["processes"].as<size_t>());
+    }
+    else if (result["mmio-bench"].as<size_t>() > 0)
+    {
+        run_mmio_benchmark(*session, dataset, result["mmio-bench"].as<size_t>());
+    }
+    else if (result["batch"].as<size_t>() > 0)
+    {
+        run_batched(*session, dataset, result["batch"].as<size_t>());
+    }
+    else if (result["recurrent"].as<size_t>() > 0)
+    {
+        run_recurrent(*session, timer, dataset, std::max<size_t>(result["streams"].as<size_t>(), 1), result["recurrent"].as<size_t>());
+    }
+    else if (result.count("cascade"))
+    {
+        std::vector<double> thresholds;
+        std::stringstream list(result["thresholds"].as<std::string>());
+        for (std::string threshold; std::getline(list, threshold, ',');)
+            thresholds.push_back(std::stod(threshold));
+
+        run_cascade(*session, model, large_model, dataset, thresholds);
+    }
+    else if (result.count("ab-a") || result.count("ab-b"))
+    {
+        run_ab(*session, configs, dataset, std::max<size_t>(result["ab-block"].as<size_t>(), 1));
+    }
+    else if (result["cpu-workers"].as<size_t>() > 0)
+    {
+        CpuModel cpu_model(layers);
+        inferences = run_heterogeneous(*session, cpu_model, dataset, result["cpu-workers"].as<size_t>());
+    }
+    else if (result["mixed"].as<bool>())
+    {
+        run_mixed_workload(*session, dataset, result["interactive-share"].as<double>(), result["interactive-rate"].as<double>(), result["deadline"].as<size_t>(), result["aging"].as<size_t>());
+    }
+    else
+    {
+        run_dataset(*session, timer, dataset, verbosity_level, result["cache"].as<size_t>(), result["duplicate-ratio"].as<double>());
+    }
+
+    if (session != NULL && simulator == NULL)
+    {
+        const DmaErrorReport &errors = session->getDmaErrors();
+        std::cout << "DMA errors: " << errors.errors[0] << " config, " << errors.errors[1] << " weight, " << errors.errors[2] << " io; "
+                  << errors.retried << " samples recovered by retry, " << errors.failed << " failed, " << errors.recovery_time / 1000.0
+                  << " us in recovery" << std::endl;
+    }
+    std::cout << "Clock: " << timer.getName() << ", resolution " << timer.getResolution() << " ns, read overhead " << timer.getOverhead() << " ns (subtracted)" << std::endl;
+
+    if (system_state != NULL)
+    {
+        system_state->stop();
+        if (result["system-state"].as<bool>())
+            system_state->report();
+        else if (system_state->throttled())
+            std::cout << "Throttling detected during the run" << std::endl;
+        delete system_state;
+    }
+
+    if (session != NULL)
+    {
+        inferences += session->getInferences() - session_inferences;
+        delete session;
+    }
+
+    if (simulator != NULL)
+    {
+        std::cout << "Simulated on " << simulator->getThreads() << " host threads";
+        if (simulator->isFixedPoint())
+            std::cout << ", " << simulator->getFixedPoint().describe();
+        std::cout << std::endl;
+        delete simulator;
+    }
+
+    if (power != NULL)
+    {
+        power->stop();
+        power->report("inference", inferences);
+        delete power;
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef MMIO_HPP
+#define MMIO_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+
+// Make every store issued so far (buffer fills, relaxed register writes) visible
+// to the device before the next MMIO write, like the kernel's wmb() before a doorbell
+inline void io_barrier()
+{
+#if defined(__aarch64__) || (defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+    asm volatile("dsb st" ::: "memory");
+#elif defined(__arm__)
+    asm volatile("mcr p15, 0, %0, c7, c10, 4" ::"r"(0) : "memory"); // ARMv6 CP15 DSB
+#elif defined(__x86_64__) || defined(__i386__)
+    asm volatile("sfence" ::: "memory");
+#else
+    __sync_synchronize();
+#endif
+}
+
+// Physical range mapped through /dev/mem. Accessors are relaxed: volatile so the
+// compiler issues exactly one access each, but without any barrier; ordering
+// against the device is established once with io_barrier().
+class MmioRegion
+{
+public:
+    MmioRegion(unsigned long physical, size_t size) : base(NULL), size(size)
+    {
+        int fd = open("/dev/mem", O_RDWR | O_SYNC);
+        if (fd < 0)
+            return;
+        void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, physical);
+        close(fd);
+        if (mapping != MAP_FAILED)
+            base = (volatile uint8_t *)mapping;
+    }
+
+    ~MmioRegion()
+    {
+        if (base != NULL)
+            munmap((void *)base, size);
+    }
+
+    bool isMapped() const
+    {
+        return base != NULL;
+    }
+
+    void write32(size_t offset, uint32_t value)
+    {
+        *(volatile uint32_t *)(base + offset) = value;
+    }
+
+    uint32_t read32(size_t offset) const
+    {
+        return *(volatile const uint32_t *)(base + offset);
+    }
+
+    // Plain (non-volatile) view for bulk buffer fills
+    void *data()
+    {
+        return (void *)base;
+    }
+
+private:
+    volatile uint8_t *base;
+    size_t size;
+};
+
+#endif
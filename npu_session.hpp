@@ -0,0 +1,896 @@
+#ifndef NPU_SESSION_HPP
+#define NPU_SESSION_HPP
+
+#include <cnpy.h>
+#include <sched.h>
+#include <vector>
+#include <cstring>
+#include <limits>
+#include "dma.hpp"
+#include "axi_dma.hpp"
+#include "dma_buffer.hpp"
+#include "stream_copy.hpp"
+#include "result_cache.hpp"
+#include "timer.hpp"
+#include "activation.hpp"
+#include "npu_simulator.hpp"
+#include "packing.hpp"
+
+// Instruction list and tiled weights of a model kept in the source windows
+struct ResidentModel
+{
+    unsigned long config_offset, config_length; // Bytes in config_src
+    unsigned long weight_offset, weight_length; // Bytes in weight_src
+    size_t dst_length;                          // Floats in the output layer
+    size_t core;                                // Cores the weights are tiled for
+    uint64_t id;                                // Content hash of instructions and weights
+    std::vector<uint64_t> instructions;         // One word per layer
+    std::vector<uint64_t> tiles;                // Hash of every weight tile, in stream order
+};
+
+// Outcome of an in-place weight update
+struct WeightUpdate
+{
+    size_t tiles, changed_tiles;
+    unsigned long bytes_written, bytes_total;
+    uint64_t time; // Nanoseconds
+};
+
+// DMA errors seen by a session and how they were recovered from
+struct DmaErrorReport
+{
+    size_t errors[3];       // Per channel: config, weight, io
+    size_t retried, failed; // Samples recovered by a retry, samples failing every attempt
+    uint64_t recovery_time; // Nanoseconds in failed attempts
+};
+
+// Cost of programming the channels and staging one input row, in nanoseconds per
+// sample
+struct MmioBenchmark
+{
+    double programming[2]; // DirectMemoryAccess, relaxed MMIO
+    double staging[3];     // writeSourceFloat(), relaxed per-float stores, stream_copy()
+    double mapping[3];     // stream_copy() per DmaBuffer::Mapping of io_src, 0 if unavailable
+};
+
+// Owns the three DMA channels of the NPU (instructions, weights, inputs/outputs)
+// and runs one sample at a time through one of the resident models. With a
+// simulator the streams are kept in host memory and executed by the simulator.
+class NpuSession
+{
+public:
+    // How the CPU waits for a channel to complete
+    enum WaitPolicy
+    {
+        Spin, // Poll the status register back to back
+        Yield // Give the CPU away between polls
+    };
+
+    NpuSession(size_t core, unsigned int verbosity_level, const Timer &timer, NpuSimulator *simulator = NULL)
+        : core(core), verbosity_level(verbosity_level), timer(timer), wait_policy(Spin), simulator(simulator),
+          config(NULL), weight(NULL), io(NULL), relaxed(false), mapped(false),
+          fast_config(NULL), fast_weight(NULL), fast_io(NULL), config_window(NULL), weight_window(NULL), io_window(NULL),
+          destination_window(NULL),
+          config_cursor(0), weight_cursor(0), stream_slot(0), stream_state(0), retries(3), dma_errors(), last_failed(false), inferences(0)
+    {
+        // The simulator keeps its streams on the heap but takes no more than the board
+        config_src = {0x30100000, 65536};
+        weight_src = {0x30110000, 33554432};
+        io_src = {0x32110000, 262144};
+        io_dst = {0x32130000, 262144};
+        if (simulator != NULL)
+            return;
+
+        config = new DirectMemoryAccess(0x40400000, &config_src, NULL);
+        weight = new DirectMemoryAccess(0x40410000, &weight_src, NULL);
+        io = new DirectMemoryAccess(0x40420000, &io_src, &io_dst);
+    }
+
+    ~NpuSession()
+    {
+        delete config;
+        delete weight;
+        delete io;
+        delete fast_config;
+        delete fast_weight;
+        delete fast_io;
+        delete config_window;
+        delete weight_window;
+        delete io_window;
+        delete destination_window;
+    }
+
+    // Index load() returns when the model does not fit in the source windows
+    static const size_t NO_MODEL = (size_t)-1;
+
+    // Append instructions and tiled weights of every layer to the source windows,
+    // tiled for `tiling` cores (0 for the session core count), returns the index of
+    // the resident model, or NO_MODEL without writing anything if the space left in
+    // config_src or weight_src is too small
+    size_t load(cnpy::npz_t &layers, size_t tiling = 0)
+    {
+        size_t core = tiling > 0 ? tiling : this->core;
+
+        // Tiling reorders the weights without padding them
+        unsigned long config_bytes = (layers.size() + 1) * 8, weight_bytes = 0;
+        for (cnpy::npz_t::iterator it = layers.begin(); it != layers.end(); it++)
+            weight_bytes += it->second.shape[0] * it->second.shape[1] * sizeof(float);
+        if ((configCursor() + 63) / 64 * 64 + config_bytes > config_src.size || (weightCursor() + 63) / 64 * 64 + weight_bytes > weight_src.size)
+            return NO_MODEL;
+
+        // Models start on a burst boundary
+        const uint64_t zero_instruction = 0;
+        const float zero_weight = 0;
+        while (configCursor() % 64)
+            writeInstructions(&zero_instruction, 1);
+        while (weightCursor() % 64)
+            writeWeights(&zero_weight, 1);
+
+        ResidentModel model = {configCursor(), 0, weightCursor(), 0, 0, core, 0, {}, {}};
+
+        // Instructions number
+        const uint64_t count = layers.size();
+        writeInstructions(&count, 1);
+        std::vector<float> packed;
+
+        // Load weights and instructions
+        for (cnpy::npz_t::iterator it = layers.begin(); it != layers.end(); it++)
+        {
+            if (verbosity_level > 1)
+            {
+                std::cout << "Loading layer \"" << it->first << "..." << std::endl;
+            }
+
+            // Instructions
+            uint64_t instruction = encode_instruction(it->second.shape[0], it->second.shape[1], activation_code(it->first));
+
+            writeInstructions(&instruction, 1);
+            model.instructions.push_back(instruction);
+            model.dst_length = it->second.shape[1]; // Save output size for destination length
+
+            // Weights
+            float *data = it->second.data<float>();
+            model.id = xxh64(data, it->second.shape[0] * it->second.shape[1] * sizeof(float), model.id ^ instruction);
+            packed.clear();
+            tile_weights(it->second, core, packed, model.tiles);
+            writeWeights(packed.data(), packed.size());
+        }
+
+        model.config_length = configCursor() - model.config_offset;
+        model.weight_length = weightCursor() - model.weight_offset;
+        models.push_back(model);
+        if (simulator != NULL)
+            simulator->invalidate();
+        if (mapped)
+            io_barrier();
+
+        // Reset destination
+        if (io != NULL)
+            memset((void *)io->getDestinationAddress(), 0, model.dst_length * 4);
+
+        if (verbosity_level > 1)
+        {
+            std::cout << "Loading " << (model.weight_length / 4) << " weights" << std::endl;
+            std::cout << "Loading " << (model.config_length / 8) << " instructions" << std::endl;
+        }
+
+        return models.size() - 1;
+    }
+
+    // Load `layers` in place of a resident model, tiled like it: the new streams
+    // are appended to the windows and take over the index of the old ones. Returns
+    // false, keeping the old model, if they do not fit.
+    bool replace(size_t model, cnpy::npz_t &layers)
+    {
+        size_t loaded = load(layers, models[model].core);
+        if (loaded == NO_MODEL)
+            return false;
+        models[model] = models[loaded];
+        models.pop_back();
+        return true;
+    }
+
+    // Bytes left in the instruction and weight windows
+    unsigned long getConfigSpace()
+    {
+        return config_src.size - configCursor();
+    }
+
+    unsigned long getWeightSpace()
+    {
+        return weight_src.size - weightCursor();
+    }
+
+    // Replace the weights of a resident model with those of `layers` in place,
+    // rewriting only the tiles whose hash changed (every tile if `full`). Returns
+    // false without touching the model if the layers differ in shape or activation,
+    // or if the weight window cannot be written at random offsets.
+    bool update(size_t model, cnpy::npz_t &layers, WeightUpdate &report, bool full = false)
+    {
+        ResidentModel &m = models[model];
+        if (simulator == NULL && !mapped)
+            return false;
+
+        std::vector<uint64_t> instructions;
+        for (cnpy::npz_t::iterator it = layers.begin(); it != layers.end(); it++)
+            instructions.push_back(encode_instruction(it->second.shape[0], it->second.shape[1], activation_code(it->first)));
+        if (instructions != m.instructions)
+            return false;
+
+        report = {m.tiles.size(), 0, 0, m.weight_length, 0};
+        uint64_t start = timer.now();
+
+        std::vector<float> packed;
+        std::vector<uint64_t> hashes;
+        unsigned long offset = m.weight_offset;
+        uint64_t id = 0;
+        size_t t = 0, l = 0;
+        for (cnpy::npz_t::iterator it = layers.begin(); it != layers.end(); it++, l++)
+        {
+            id = xxh64(it->second.data<float>(), it->second.shape[0] * it->second.shape[1] * sizeof(float), id ^ instructions[l]);
+            packed.clear();
+            hashes.clear();
+            tile_weights(it->second, m.core, packed, hashes);
+
+            // Tiles are inputs x range floats, range being core but for the last one
+            size_t outputs = it->second.shape[1], inputs = it->second.shape[0], begin = 0;
+            for (size_t h = 0; h < hashes.size(); h++, t++)
+            {
+                size_t length = inputs * std::min(m.core, outputs - h * m.core);
+                if (full || hashes[h] != m.tiles[t])
+                {
+                    writeWeightsAt(offset + begin * 4, &packed[begin], length);
+                    m.tiles[t] = hashes[h];
+                    report.changed_tiles++;
+                    report.bytes_written += length * 4;
+                }
+                begin += length;
+            }
+            offset += packed.size() * 4;
+        }
+
+        if (simulator != NULL)
+            simulator->invalidate();
+        if (mapped)
+            io_barrier();
+        m.id = id;
+        report.time = timer.elapsed(start, timer.now());
+        return true;
+    }
+
+    void setWaitPolicy(WaitPolicy policy)
+    {
+        wait_policy = policy;
+    }
+
+    // Attempts after the first when a channel reports an error
+    void setRetries(size_t retries)
+    {
+        this->retries = retries;
+    }
+
+    const DmaErrorReport &getDmaErrors() const
+    {
+        return dma_errors;
+    }
+
+    // Program the channels and stage inputs through relaxed register and buffer
+    // accesses with one barrier per doorbell instead of going through
+    // DirectMemoryAccess, returns false if the registers or windows cannot be
+    // mapped. Once mapped, models are loaded with stream_copy() through the source
+    // windows. The destination is mapped cached unless sources are uncached.
+    bool setRelaxedMmio(bool enabled, DmaBuffer::Mapping source_mapping = DmaBuffer::Uncached)
+    {
+        if (enabled && io_window == NULL && simulator == NULL)
+        {
+            DmaBuffer::Mapping destination_mapping = source_mapping == DmaBuffer::Uncached ? DmaBuffer::Uncached : DmaBuffer::Cached;
+            fast_config = new AxiDmaChannel(0x40400000, false);
+            fast_weight = new AxiDmaChannel(0x40410000, false);
+            fast_io = new AxiDmaChannel(0x40420000, true);
+            config_window = new DmaBuffer(config_src.addr, 65536, source_mapping);
+            weight_window = new DmaBuffer(weight_src.addr, 33554432, source_mapping);
+            io_window = new DmaBuffer(io_src.addr, 262144, source_mapping);
+            destination_window = new DmaBuffer(io_dst.addr, 262144, destination_mapping);
+            if (fast_config->isMapped() && fast_weight->isMapped() && fast_io->isMapped() && config_window->isMapped() &&
+                weight_window->isMapped() && io_window->isMapped() && destination_window->isMapped())
+            {
+                // Continue the streams where DirectMemoryAccess left them
+                config_cursor = config->getCursor();
+                weight_cursor = weight->getCursor();
+                mapped = true;
+            }
+        }
+        if (enabled && !mapped)
+            return false;
+        relaxed = enabled;
+        return true;
+    }
+
+    // Time arming the three channels both ways and staging a row of `length`
+    // floats per float, in bursts, and in bursts through every mapping of io_src
+    // (cache clean included); no transfer is started. Requires setRelaxedMmio(true)
+    // to succeed.
+    MmioBenchmark benchmarkMmio(size_t iterations, size_t length)
+    {
+        MmioBenchmark benchmark;
+        std::vector<float> input(length, 0.5f);
+        bool previous = relaxed;
+
+        for (size_t mode = 0; mode < 2; mode++)
+        {
+            relaxed = mode == 1;
+
+            uint64_t start = timer.now();
+            for (size_t i = 0; i < iterations; i++)
+            {
+                arm();
+                if (relaxed)
+                    io_barrier(); // Paid by the doorbell
+            }
+            benchmark.programming[mode] = (double)timer.elapsed(start, timer.now()) / iterations;
+        }
+        relaxed = previous;
+
+        uint64_t start = timer.now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            io->resetCursor();
+            for (size_t j = 0; j < length; j++)
+                io->writeSourceFloat(input[j]);
+        }
+        benchmark.staging[0] = (double)timer.elapsed(start, timer.now()) / iterations;
+
+        start = timer.now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            volatile float *window = (volatile float *)io_window->data();
+            for (size_t j = 0; j < length; j++)
+                window[j] = input[j];
+            io_barrier();
+        }
+        benchmark.staging[1] = (double)timer.elapsed(start, timer.now()) / iterations;
+
+        start = timer.now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            stream_copy(io_window->data(), input.data(), length * 4);
+            io_barrier();
+        }
+        benchmark.staging[2] = (double)timer.elapsed(start, timer.now()) / iterations;
+
+        for (size_t mapping = 0; mapping < 3; mapping++)
+        {
+            DmaBuffer window(io_src.addr, 262144, (DmaBuffer::Mapping)mapping);
+            benchmark.mapping[mapping] = 0;
+            if (!window.isMapped())
+                continue;
+
+            start = timer.now();
+            for (size_t i = 0; i < iterations; i++)
+            {
+                stream_copy(window.data(), input.data(), length * 4);
+                window.syncForDevice(0, length * 4);
+                io_barrier();
+            }
+            benchmark.mapping[mapping] = (double)timer.elapsed(start, timer.now()) / iterations;
+        }
+
+        return benchmark;
+    }
+
+    size_t getInputLength(size_t model = 0) const
+    {
+        return instruction_inputs(models[model].instructions[0]);
+    }
+
+    size_t getOutputLength(size_t model = 0) const
+    {
+        return models[model].dst_length;
+    }
+
+    // Bytes of the instruction stream of a resident model
+    unsigned long getConfigLength(size_t model = 0) const
+    {
+        return models[model].config_length;
+    }
+
+    // Whether one instruction stream can drive a batch: only the simulator decodes
+    // the batch header, the NPU runs one sample per stream
+    bool supportsBatch() const
+    {
+        return simulator != NULL;
+    }
+
+    // Samples run so far by run(), runBatch() and step()
+    size_t getInferences() const
+    {
+        return inferences;
+    }
+
+    // Whether the last run() or step() failed on every DMA attempt, or any sample
+    // of the last runBatch()
+    bool hasFailed() const
+    {
+        return last_failed;
+    }
+
+    // Content hash of the instructions and weights of a resident model
+    uint64_t getModelId(size_t model = 0) const
+    {
+        return models[model].id;
+    }
+
+    // Run one sample through a resident model, fill results with the output layer
+    // and return the execution time in nanoseconds (staging excluded). If the DMA
+    // fails on every attempt the outputs are NaN and hasFailed() is true.
+    uint64_t run(const float *input, size_t length, std::vector<float> &results, size_t model = 0)
+    {
+        const ResidentModel &m = models[model];
+        inferences++;
+
+        if (simulator != NULL)
+        {
+            uint64_t start = timer.now();
+            simulator->execute(&config_stream[m.config_offset / 8], &weight_stream[m.weight_offset / 4], m.core, input, length, results);
+            return timer.elapsed(start, timer.now());
+        }
+
+        unsigned long staged = stage(input, length);
+
+        if (verbosity_level > 1)
+        {
+            std::cout << "Loading " << (staged / 4) << " inputs" << std::endl;
+        }
+
+        uint64_t time;
+        if (!transferWithRecovery(m, io_src.addr, staged, io_dst.addr, time))
+        {
+            results.insert(results.end(), m.dst_length, std::numeric_limits<float>::quiet_NaN());
+            return time;
+        }
+
+        // Extract results
+        float *fp = (float *)io->getDestinationAddress();
+        if (relaxed)
+        {
+            destination_window->syncForCpu(0, m.dst_length * 4);
+            fp = (float *)destination_window->data();
+        }
+        for (size_t i = 0; i < m.dst_length; i++)
+            results.push_back(fp[i]);
+
+        return time;
+    }
+
+    // Run `batch` samples of `length` floats stored `stride` floats apart through a
+    // resident model and append the outputs of every sample to results. With batch support a
+    // single instruction stream with a batch header drives the whole batch,
+    // otherwise the instructions are sent again for every sample. Returns the
+    // execution time in nanoseconds, config_bytes the bytes sent on the config
+    // channel. Samples the DMA failed on have NaN outputs and set hasFailed().
+    uint64_t runBatch(const float *inputs, size_t batch, size_t length, size_t stride, std::vector<float> &results, unsigned long &config_bytes, size_t model = 0)
+    {
+        const ResidentModel &m = models[model];
+        if (!supportsBatch())
+        {
+            uint64_t time = 0;
+            bool any_failed = false;
+            for (size_t n = 0; n < batch; n++)
+            {
+                time += run(inputs + n * stride, length, results, model);
+                any_failed = any_failed || last_failed;
+            }
+            last_failed = any_failed;
+            config_bytes = batch * m.config_length;
+            return time;
+        }
+
+        inferences += batch;
+        last_failed = false;
+        batch_stream.clear();
+        batch_stream.push_back(encode_batch_header(batch, m.instructions.size()));
+        batch_stream.push_back(encode_batch_strides(stride, m.dst_length));
+        batch_stream.insert(batch_stream.end(), m.instructions.begin(), m.instructions.end());
+        config_bytes = batch_stream.size() * 8;
+
+        uint64_t start = timer.now();
+        simulator->execute(batch_stream.data(), &weight_stream[m.weight_offset / 4], m.core, inputs, length, results);
+        return timer.elapsed(start, timer.now());
+    }
+
+    // Reserve `streams` slots at the top of io_src for a recurrent model whose input
+    // is [state | x] and output [state | y]. The output of a step is sent back into
+    // the slot of its stream, so the next step only stages x. Needs the simulator
+    // or mapped windows, returns false otherwise or if the slots do not fit in the
+    // upper half of io_src.
+    bool reserveStreams(size_t streams, size_t state, size_t model = 0)
+    {
+        const ResidentModel &m = models[model];
+        size_t input_length = getInputLength(model);
+        if ((simulator == NULL && !mapped) || state > input_length || state > m.dst_length)
+            return false;
+        size_t slot = (std::max(input_length, m.dst_length) * 4 + 63) / 64 * 64;
+        if (streams * slot > 262144 / 2)
+            return false;
+
+        stream_slot = slot;
+        stream_state = state;
+        if (simulator != NULL)
+            io_stream.assign(262144 / 4, 0);
+        for (size_t stream = 0; stream < streams; stream++)
+            resetStream(stream);
+        return true;
+    }
+
+    // Start a new sequence on a stream
+    void resetStream(size_t stream)
+    {
+        std::vector<float> zero(stream_state, 0);
+        writeStream(streamOffset(stream), zero.data(), stream_state);
+    }
+
+    void getStreamState(size_t stream, std::vector<float> &state)
+    {
+        const float *slot = simulator != NULL ? &io_stream[streamOffset(stream) / 4] : (const float *)((uint8_t *)io_window->data() + streamOffset(stream));
+        state.assign(slot, slot + stream_state);
+    }
+
+    // Run one step of a stream: stage x after the state kept in its slot, fill
+    // results with y and return the execution time in nanoseconds (staging excluded).
+    // A step that fails on every DMA attempt leaves the state as it was.
+    uint64_t step(size_t stream, const float *input, size_t length, std::vector<float> &results, size_t model = 0)
+    {
+        const ResidentModel &m = models[model];
+        unsigned long offset = streamOffset(stream);
+        inferences++;
+        writeStream(offset + stream_state * 4, input, length);
+
+        uint64_t time;
+        const float *output;
+        if (simulator != NULL)
+        {
+            float *slot = &io_stream[offset / 4];
+            step_output.clear();
+            uint64_t start = timer.now();
+            simulator->execute(&config_stream[m.config_offset / 8], &weight_stream[m.weight_offset / 4], m.core, slot, stream_state + length, step_output);
+            time = timer.elapsed(start, timer.now());
+            std::copy(step_output.begin(), step_output.end(), slot);
+            output = slot;
+        }
+        else
+        {
+            // An S2MM error may leave part of an output over [state | x], so every
+            // retry restages it from a host copy
+            const float *slot = (const float *)((uint8_t *)io_window->data() + offset);
+            step_input.assign(slot, slot + stream_state);
+            step_input.insert(step_input.end(), input, input + length);
+            if (!transferWithRecovery(m, io_src.addr + offset, (stream_state + length) * 4, io_src.addr + offset, time, step_input.data()))
+            {
+                writeStream(offset, step_input.data(), stream_state);
+                results.insert(results.end(), m.dst_length - stream_state, std::numeric_limits<float>::quiet_NaN());
+                return time;
+            }
+            io_window->syncForCpu(offset, m.dst_length * 4);
+            output = (const float *)((uint8_t *)io_window->data() + offset);
+        }
+
+        results.insert(results.end(), output + stream_state, output + m.dst_length);
+        return time;
+    }
+
+private:
+    void writeInstructions(const uint64_t *instructions, size_t count)
+    {
+        if (simulator != NULL)
+        {
+            config_stream.resize(config_stream.size() + count);
+            stream_copy(&config_stream[config_stream.size() - count], instructions, count * 8);
+        }
+        else if (mapped)
+        {
+            stream_copy((uint8_t *)config_window->data() + config_cursor, instructions, count * 8);
+            config_window->syncForDevice(config_cursor, count * 8);
+            config_cursor += count * 8;
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+                config->writeSourceUInt64(instructions[i]);
+        }
+    }
+
+    void writeWeights(const float *weights, size_t count)
+    {
+        if (simulator != NULL)
+        {
+            weight_stream.resize(weight_stream.size() + count);
+            stream_copy(&weight_stream[weight_stream.size() - count], weights, count * 4);
+        }
+        else if (mapped)
+        {
+            stream_copy((uint8_t *)weight_window->data() + weight_cursor, weights, count * 4);
+            weight_window->syncForDevice(weight_cursor, count * 4);
+            weight_cursor += count * 4;
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+                weight->writeSourceFloat(weights[i]);
+        }
+    }
+
+    // Overwrite weights already in the stream, `offset` in bytes
+    void writeWeightsAt(unsigned long offset, const float *weights, size_t count)
+    {
+        if (simulator != NULL)
+        {
+            stream_copy(&weight_stream[offset / 4], weights, count * 4);
+        }
+        else
+        {
+            stream_copy((uint8_t *)weight_window->data() + offset, weights, count * 4);
+            weight_window->syncForDevice(offset, count * 4);
+        }
+    }
+
+    // Bytes written to the instruction and weight streams
+    unsigned long configCursor()
+    {
+        if (simulator != NULL)
+            return config_stream.size() * 8;
+        return mapped ? config_cursor : config->getCursor();
+    }
+
+    unsigned long weightCursor()
+    {
+        if (simulator != NULL)
+            return weight_stream.size() * 4;
+        return mapped ? weight_cursor : weight->getCursor();
+    }
+
+    // transfer() until no channel reports an error, up to `retries` further
+    // attempts; each one starts by resetting the three channels, which clears the
+    // error. A source in the io window the output may have overwritten is rewritten
+    // from `restage` before each retry. Returns false if every attempt failed, time
+    // being the last attempt.
+    bool transferWithRecovery(const ResidentModel &m, unsigned long source, unsigned long length, unsigned long destination, uint64_t &time,
+                              const float *restage = NULL)
+    {
+        last_failed = false;
+        for (size_t attempt = 0;; attempt++)
+        {
+            if (attempt > 0 && restage != NULL)
+                writeStream(source - io_src.addr, restage, length / 4);
+            int failed;
+            time = transfer(m, source, length, destination, failed);
+            if (failed < 0)
+            {
+                dma_errors.retried += attempt > 0;
+                return true;
+            }
+
+            dma_errors.errors[failed]++;
+            dma_errors.recovery_time += time;
+            if (attempt == retries)
+            {
+                dma_errors.failed++;
+                last_failed = true;
+                return false;
+            }
+        }
+    }
+
+    // Send `length` bytes of input at `source` through a model and receive its
+    // output at `destination`, returns the time in nanoseconds. failed is the
+    // channel (0 config, 1 weight, 2 io) whose status reported an error or that
+    // did not come out of reset, -1 if none; the transfer stops there.
+    uint64_t transfer(const ResidentModel &m, unsigned long source, unsigned long length, unsigned long destination, int &failed)
+    {
+        uint64_t start = timer.now();
+
+        // Init
+        failed = arm();
+        if (failed >= 0)
+            return timer.elapsed(start, timer.now());
+
+        // Listen
+        if (relaxed)
+        {
+            fast_io->setDestinationAddress(destination);
+            fast_io->startDestination(m.dst_length * 4);
+        }
+        else
+        {
+            io->setDestinationAddress(destination);
+            io->setDestinationLength(m.dst_length * 4);
+        }
+
+        // Send instructions
+        startSource(config, fast_config, config_src.addr + m.config_offset, m.config_length);
+        if (verbosity_level > 1)
+        {
+            std::cout << "Waiting for Instructions MM2S..." << std::endl;
+        }
+        if (AxiDmaChannel::isError(wait(config, fast_config, false)))
+        {
+            failed = 0;
+            return timer.elapsed(start, timer.now());
+        }
+
+        // Send input
+        startSource(io, fast_io, source, length);
+        if (verbosity_level > 1)
+        {
+            std::cout << "Waiting for IO MM2S..." << std::endl;
+        }
+        if (AxiDmaChannel::isError(wait(io, fast_io, false)))
+        {
+            failed = 2;
+            return timer.elapsed(start, timer.now());
+        }
+
+        // Send weights
+        startSource(weight, fast_weight, weight_src.addr + m.weight_offset, m.weight_length);
+        if (verbosity_level > 1)
+        {
+            std::cout << "Waiting for Weights MM2S..." << std::endl;
+        }
+        if (AxiDmaChannel::isError(wait(weight, fast_weight, false)))
+        {
+            failed = 1;
+            return timer.elapsed(start, timer.now());
+        }
+
+        // Wait for output
+        if (verbosity_level > 1)
+        {
+            std::cout << "Waiting for IO S2MM..." << std::endl;
+        }
+        if (AxiDmaChannel::isError(wait(io, fast_io, true)))
+            failed = 2;
+
+        return timer.elapsed(start, timer.now());
+    }
+
+    // Slots are stacked down from the end of io_src
+    unsigned long streamOffset(size_t stream) const
+    {
+        return 262144 - (stream + 1) * stream_slot;
+    }
+
+    void writeStream(unsigned long offset, const float *values, size_t count)
+    {
+        if (simulator != NULL)
+        {
+            std::copy(values, values + count, &io_stream[offset / 4]);
+        }
+        else
+        {
+            stream_copy((uint8_t *)io_window->data() + offset, values, count * 4);
+            io_window->syncForDevice(offset, count * 4);
+        }
+    }
+
+    // Copy an input row to the io source window, returns the bytes staged
+    unsigned long stage(const float *input, size_t length)
+    {
+        if (relaxed)
+        {
+            stream_copy(io_window->data(), input, length * 4);
+            io_window->syncForDevice(0, length * 4);
+            return length * 4;
+        }
+
+        io->resetCursor();
+        for (size_t i = 0; i < length; i++)
+        {
+            io->writeSourceFloat(input[i]);
+        }
+        return io->getCursor();
+    }
+
+    // Reset the three channels and enable them with both interrupts, returns the
+    // channel stuck in reset (relaxed MMIO only), -1 if none
+    int arm()
+    {
+        if (relaxed)
+        {
+            AxiDmaChannel *channels[] = {fast_config, fast_weight, fast_io};
+            for (int c = 0; c < 3; c++)
+            {
+                if (!channels[c]->arm())
+                    return c;
+            }
+            return -1;
+        }
+
+        config->reset();
+        config->halt();
+        config->setInterrupt(true, true, 0);
+        config->ready();
+
+        weight->reset();
+        weight->halt();
+        weight->setInterrupt(true, true, 0);
+        weight->ready();
+
+        io->reset();
+        io->halt();
+        io->setInterrupt(true, true, 0);
+        io->ready();
+        return -1;
+    }
+
+    // Start the MM2S transfer of a channel, the length write being the doorbell
+    void startSource(DirectMemoryAccess *channel, AxiDmaChannel *fast, unsigned long address, unsigned long length)
+    {
+        if (relaxed)
+        {
+            fast->setSourceAddress(address);
+            fast->startSource(length);
+        }
+        else
+        {
+            channel->setSourceAddress(address);
+            channel->setSourceLength(length);
+        }
+    }
+
+    // Poll a channel until it is halted, idle or reports an error
+    unsigned long wait(DirectMemoryAccess *channel, AxiDmaChannel *fast, bool s2mm)
+    {
+        unsigned long status, mem_status = -1;
+        do
+        {
+            if (relaxed)
+                status = s2mm ? fast->getS2MMStatus() : fast->getMM2SStatus();
+            else
+                status = s2mm ? channel->getS2MMStatus() : channel->getMM2SStatus();
+            if (verbosity_level > 1)
+            {
+                if (mem_status != status)
+                    channel->dumpStatus(status);
+                mem_status = status;
+            }
+            if (wait_policy == Yield)
+                sched_yield();
+        } while (
+            !(status & 1 << 0) &&
+            !(status & 1 << 1) &&
+            !(status & 1 << 4) &&
+            !(status & 1 << 12) &&
+            !(status & 1 << 14));
+        return status;
+    }
+
+    size_t core;
+    unsigned int verbosity_level;
+    const Timer &timer;
+    WaitPolicy wait_policy;
+    std::vector<ResidentModel> models;
+
+    NpuSimulator *simulator;
+    std::vector<uint64_t> config_stream;
+    std::vector<float> weight_stream;
+    std::vector<uint64_t> batch_stream;
+
+    mmap_params config_src, weight_src, io_src, io_dst;
+    DirectMemoryAccess *config, *weight, *io;
+
+    bool relaxed, mapped;
+    AxiDmaChannel *fast_config, *fast_weight, *fast_io;
+    DmaBuffer *config_window, *weight_window, *io_window, *destination_window; // Second mappings of the windows
+    unsigned long config_cursor, weight_cursor;
+
+    size_t stream_slot, stream_state;    // Bytes per slot, floats of state
+    std::vector<float> io_stream;        // Simulated io_src holding the slots
+    std::vector<float> step_output;
+    std::vector<float> step_input; // Host copy of [state | x] restaged before a retry
+
+    size_t retries;
+    DmaErrorReport dma_errors;
+    bool last_failed;
+    size_t inferences;
+};
+
+#endif
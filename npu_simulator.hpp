@@ -0,0 +1,208 @@
+#ifndef NPU_SIMULATOR_HPP
+#define NPU_SIMULATOR_HPP
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include "activation.hpp"
+#include "fixed_point.hpp"
+#include "packing.hpp"
+#include "thread_pool.hpp"
+
+// Accumulate one core-wide tile: every core owns one output and adds
+// input[node] * weight in node order, exactly as the packed stream delivers them.
+// Vectorized across cores so each output keeps its sequential accumulation order.
+inline void accumulate_tile(const float *input, const float *weights, size_t inputs, size_t range, float *outputs)
+{
+    for (size_t i = 0; i < range; i++)
+        outputs[i] = 0;
+
+    for (size_t node = 0; node < inputs; node++)
+    {
+        const float *row = weights + node * range;
+        float x = input[node];
+        size_t i = 0;
+#if defined(__ARM_NEON)
+        float32x4_t xv = vdupq_n_f32(x);
+        for (; i + 4 <= range; i += 4)
+            vst1q_f32(outputs + i, vaddq_f32(vld1q_f32(outputs + i), vmulq_f32(xv, vld1q_f32(row + i))));
+#elif defined(__SSE__)
+        __m128 xv = _mm_set1_ps(x);
+        for (; i + 4 <= range; i += 4)
+            _mm_storeu_ps(outputs + i, _mm_add_ps(_mm_loadu_ps(outputs + i), _mm_mul_ps(xv, _mm_loadu_ps(row + i))));
+#endif
+        for (; i < range; i++)
+            outputs[i] += x * row[i];
+    }
+}
+
+// Functional model of the NPU consuming the same instruction and weight streams
+// as the DMA channels. The tiles of a layer are spread over host threads, each
+// thread streaming a contiguous block of the packed weights. The datapath is IEEE
+// float unless a fixed-point format is set.
+class NpuSimulator
+{
+public:
+    NpuSimulator(size_t threads) : pool(threads), fixed_point(false) {}
+
+    size_t getThreads() const
+    {
+        return pool.size();
+    }
+
+    void setFixedPoint(const FixedPointFormat &format)
+    {
+        this->format = format;
+        fixed_point = true;
+        invalidate();
+    }
+
+    bool isFixedPoint() const
+    {
+        return fixed_point;
+    }
+
+    const FixedPointFormat &getFixedPoint() const
+    {
+        return format;
+    }
+
+    // Drop data derived from the weight streams, to be called when they change
+    void invalidate()
+    {
+        quantized_weights.clear();
+    }
+
+    // instructions: instruction stream (optional batch header, layer count, one word
+    // per layer), weights: tiled for `core`, length: floats of one sample. A batched
+    // stream runs every sample of the batch, each output padded to the output stride.
+    void execute(const uint64_t *instructions, const float *weights, size_t core, const float *input, size_t length, std::vector<float> &results)
+    {
+        InstructionStream stream = decode_stream(instructions);
+        size_t input_stride = stream.input_stride > 0 ? stream.input_stride : length;
+
+        for (size_t n = 0; n < stream.batch; n++)
+        {
+            size_t begin = results.size();
+            if (fixed_point)
+                executeFixed(stream, weights, core, input + n * input_stride, length, results);
+            else
+                executeSample(stream, weights, core, input + n * input_stride, length, results);
+            if (results.size() - begin < stream.output_stride)
+                results.resize(begin + stream.output_stride, 0);
+        }
+    }
+
+private:
+    void executeSample(const InstructionStream &stream, const float *weights, size_t core, const float *input, size_t length, std::vector<float> &results)
+    {
+        current.assign(input, input + length);
+
+        for (size_t l = 0; l < stream.layers; l++)
+        {
+            size_t inputs = instruction_inputs(stream.instructions[l]);
+            size_t outputs = instruction_outputs(stream.instructions[l]);
+            unsigned int activation = instruction_activation(stream.instructions[l]);
+            size_t tiles = (outputs + core - 1) / core;
+
+            current.resize(inputs, 0);
+            next.assign(outputs, 0);
+            auto tile = [&](size_t t) {
+                size_t offset = t * core;
+                accumulate_tile(current.data(), weights + offset * inputs, inputs, std::min(core, outputs - offset), &next[offset]);
+            };
+
+            // Small layers are not worth waking the pool for
+            if (inputs * outputs >= parallel_threshold && tiles > 1)
+            {
+                pool.parallelFor(tiles, tile);
+            }
+            else
+            {
+                for (size_t t = 0; t < tiles; t++)
+                    tile(t);
+            }
+
+            activate(activation, next.data(), outputs);
+            weights += inputs * outputs;
+            current.swap(next);
+        }
+
+        results.insert(results.end(), current.begin(), current.end());
+    }
+
+    void executeFixed(const InstructionStream &stream, const float *weights, size_t core, const float *input, size_t length, std::vector<float> &results)
+    {
+        const int32_t *w = quantize(stream, weights);
+        current_fixed.resize(length);
+        for (size_t i = 0; i < length; i++)
+            current_fixed[i] = format.quantize(input[i]);
+
+        for (size_t l = 0; l < stream.layers; l++)
+        {
+            size_t inputs = instruction_inputs(stream.instructions[l]);
+            size_t outputs = instruction_outputs(stream.instructions[l]);
+            unsigned int activation = instruction_activation(stream.instructions[l]);
+            size_t tiles = (outputs + core - 1) / core;
+
+            current_fixed.resize(inputs, 0);
+            next_fixed.assign(outputs, 0);
+            auto tile = [&](size_t t) {
+                size_t offset = t * core, range = std::min(core, outputs - offset);
+                accumulate_tile_fixed(current_fixed.data(), w + offset * inputs, inputs, range, &next_fixed[offset], format);
+                for (size_t i = offset; i < offset + range; i++)
+                    next_fixed[i] = format.requantize(next_fixed[i]);
+            };
+
+            if (inputs * outputs >= parallel_threshold && tiles > 1)
+            {
+                pool.parallelFor(tiles, tile);
+            }
+            else
+            {
+                for (size_t t = 0; t < tiles; t++)
+                    tile(t);
+            }
+
+            format.activate(activation, next_fixed.data(), outputs);
+            w += inputs * outputs;
+            current_fixed.swap(next_fixed);
+        }
+
+        for (int32_t raw : current_fixed)
+            results.push_back(format.dequantize(raw));
+    }
+
+    // Weights of a model in the operand format, converted on first use
+    const int32_t *quantize(const InstructionStream &stream, const float *weights)
+    {
+        std::vector<int32_t> &q = quantized_weights[weights];
+        if (q.empty())
+        {
+            size_t count = 0;
+            for (size_t l = 0; l < stream.layers; l++)
+                count += instruction_inputs(stream.instructions[l]) * instruction_outputs(stream.instructions[l]);
+            q.resize(count);
+            for (size_t i = 0; i < count; i++)
+                q[i] = format.quantize(weights[i]);
+        }
+        return q.data();
+    }
+
+    static const size_t parallel_threshold = 16384; // Multiply-accumulates
+
+    ThreadPool pool;
+    std::vector<float> current, next;
+
+    bool fixed_point;
+    FixedPointFormat format;
+    std::vector<int32_t> current_fixed, next_fixed;
+    std::map<const float *, std::vector<int32_t>> quantized_weights;
+};
+
+#endif
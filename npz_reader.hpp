@@ -0,0 +1,237 @@
+#ifndef NPZ_READER_HPP
+#define NPZ_READER_HPP
+
+#include <cnpy.h>
+#include <zlib.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "file_reader.hpp"
+
+// Bytes of a FileReader as one stream, crossing chunk boundaries
+class ChunkStream
+{
+public:
+    ChunkStream(FileReader &reader) : reader(reader), data(NULL), length(0), position(0) {}
+
+    // Contiguous bytes available without waiting for another chunk, up to `max`
+    size_t available(const uint8_t *&bytes, uint64_t max)
+    {
+        if (position == length)
+        {
+            if (!reader.next(data, length))
+                return 0;
+            position = 0;
+        }
+        bytes = data + position;
+        return std::min<uint64_t>(length - position, max);
+    }
+
+    void consume(size_t count)
+    {
+        position += count;
+    }
+
+    bool read(void *destination, uint64_t count)
+    {
+        uint8_t *out = (uint8_t *)destination;
+        while (count > 0)
+        {
+            const uint8_t *bytes;
+            size_t n = available(bytes, count);
+            if (n == 0)
+                return false;
+            if (out != NULL)
+            {
+                memcpy(out, bytes, n);
+                out += n;
+            }
+            consume(n);
+            count -= n;
+        }
+        return true;
+    }
+
+    bool skip(uint64_t count)
+    {
+        return read(NULL, count);
+    }
+
+private:
+    FileReader &reader;
+    const uint8_t *data;
+    size_t length, position;
+};
+
+// Fills buffers with the content of one zip entry, inflating deflated entries as
+// the compressed bytes arrive
+class ZipEntryReader
+{
+public:
+    ZipEntryReader(ChunkStream &stream, uint16_t method, uint64_t compressed) : stream(stream), deflated(method == 8), remaining(compressed)
+    {
+        memset(&z, 0, sizeof(z));
+        if (deflated && inflateInit2(&z, -MAX_WBITS) != Z_OK)
+            throw std::runtime_error("npz_read: inflateInit2 failed");
+    }
+
+    ~ZipEntryReader()
+    {
+        if (deflated)
+            inflateEnd(&z);
+    }
+
+    bool read(void *destination, size_t count)
+    {
+        if (!deflated)
+        {
+            if (count > remaining)
+                return false;
+            remaining -= count;
+            return stream.read(destination, count);
+        }
+
+        z.next_out = (Bytef *)destination;
+        z.avail_out = count;
+        while (z.avail_out > 0)
+        {
+            if (z.avail_in == 0)
+            {
+                // The chunk stays valid until zlib has consumed all of it
+                const uint8_t *bytes;
+                size_t n = stream.available(bytes, remaining);
+                if (n == 0)
+                    return false;
+                stream.consume(n);
+                remaining -= n;
+                z.next_in = (Bytef *)bytes;
+                z.avail_in = n;
+            }
+            int status = inflate(&z, Z_NO_FLUSH);
+            if (status == Z_STREAM_END && z.avail_out > 0)
+                return false;
+            if (status != Z_OK && status != Z_STREAM_END)
+                return false;
+        }
+        return true;
+    }
+
+    // Skip the compressed bytes not needed to produce the content
+    bool finish()
+    {
+        return stream.skip(remaining);
+    }
+
+private:
+    ChunkStream &stream;
+    bool deflated;
+    uint64_t remaining; // Compressed bytes not yet taken from the stream
+    z_stream z;
+};
+
+inline uint64_t zip_field(const uint8_t *bytes, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+        value |= (uint64_t)bytes[i] << (8 * i);
+    return value;
+}
+
+// Word size, shape and order from the header dictionary of a .npy file
+inline void parse_npy_dictionary(const std::string &header, size_t &word_size, std::vector<size_t> &shape, bool &fortran_order)
+{
+    size_t descr = header.find("'descr'"), shape_begin = header.find("'shape'");
+    if (descr == std::string::npos || shape_begin == std::string::npos)
+        throw std::runtime_error("npz_read: malformed npy header");
+    descr = header.find('\'', header.find(':', descr)) + 1;
+    word_size = std::stoul(header.substr(descr + 2));
+    fortran_order = header.find("'fortran_order': True") != std::string::npos;
+
+    shape.clear();
+    size_t begin = header.find('(', shape_begin) + 1, end = header.find(')', begin);
+    for (size_t p = begin; p < end; p = header.find(',', p) + 1)
+    {
+        size_t digit = header.find_first_of("0123456789", p);
+        if (digit >= end)
+            break;
+        shape.push_back(std::stoul(header.substr(digit)));
+        if (header.find(',', p) >= end)
+            break;
+    }
+}
+
+// Drop-in for cnpy::npz_load that reads the archive through a FileReader and
+// decodes every entry as its bytes land: the npy header first, then the array
+// inflated straight into its storage. Needs the sizes in the local file headers
+// (NumPy writes them, ZIP64 included). Throws on a read error, wherever it falls.
+inline cnpy::npz_t npz_read(const std::string &path, size_t chunk = 1 << 20, size_t depth = 4)
+{
+    FileReader reader(path, chunk, depth);
+    if (!reader.isOpen())
+        throw std::runtime_error("npz_read: unable to open " + path);
+    ChunkStream stream(reader);
+    cnpy::npz_t arrays;
+
+    uint8_t header[30];
+    while (stream.read(header, 30) && zip_field(header, 4) == 0x04034b50)
+    {
+        uint64_t flags = zip_field(header + 6, 2), method = zip_field(header + 8, 2);
+        uint64_t compressed = zip_field(header + 18, 4), size = zip_field(header + 22, 4);
+        std::string name(zip_field(header + 26, 2), 0);
+        std::vector<uint8_t> extra(zip_field(header + 28, 2));
+        if (!stream.read(&name[0], name.size()) || !stream.read(extra.data(), extra.size()))
+            throw std::runtime_error("npz_read: truncated entry header in " + path);
+
+        // ZIP64: the sizes stored as 0xFFFFFFFF follow in the extra field
+        for (size_t p = 0; p + 4 <= extra.size(); p += 4 + zip_field(&extra[p + 2], 2))
+        {
+            if (zip_field(&extra[p], 2) != 1)
+                continue;
+            size_t q = p + 4;
+            if (size == 0xFFFFFFFF && q + 8 <= extra.size())
+            {
+                size = zip_field(&extra[q], 8);
+                q += 8;
+            }
+            if (compressed == 0xFFFFFFFF && q + 8 <= extra.size())
+                compressed = zip_field(&extra[q], 8);
+        }
+        if ((flags & 8) || (method != 0 && method != 8))
+            throw std::runtime_error("npz_read: unsupported entry " + name + " in " + path);
+
+        ZipEntryReader entry(stream, method, compressed);
+        uint8_t preamble[12];
+        if (!entry.read(preamble, 10) || memcmp(preamble, "\x93NUMPY", 6) != 0)
+            throw std::runtime_error("npz_read: " + name + " is not a npy array");
+        size_t header_length = zip_field(preamble + 8, 2);
+        if (preamble[6] > 1)
+        {
+            if (!entry.read(preamble + 10, 2))
+                throw std::runtime_error("npz_read: truncated " + name);
+            header_length = zip_field(preamble + 8, 4);
+        }
+        std::string dictionary(header_length, 0);
+        if (!entry.read(&dictionary[0], header_length))
+            throw std::runtime_error("npz_read: truncated " + name);
+
+        size_t word_size;
+        std::vector<size_t> shape;
+        bool fortran_order;
+        parse_npy_dictionary(dictionary, word_size, shape, fortran_order);
+        cnpy::NpyArray array(shape, word_size, fortran_order);
+        if (!entry.read(array.data<char>(), array.num_bytes()) || !entry.finish())
+            throw std::runtime_error("npz_read: truncated " + name);
+
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0)
+            name.erase(name.size() - 4);
+        arrays[name] = array;
+    }
+
+    // A failed chunk ends the loop like the end of the entries would
+    if (reader.hasFailed())
+        throw std::runtime_error("npz_read: read error in " + path);
+    return arrays;
+}
+
+#endif
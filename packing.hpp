@@ -0,0 +1,83 @@
+#ifndef PACKING_HPP
+#define PACKING_HPP
+
+#include <cnpy.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "result_cache.hpp"
+
+// Instruction word of a layer: inputs from bit 34, outputs in bits 4 to 33 and
+// the activation code in bits 0 to 3
+inline uint64_t encode_instruction(uint64_t inputs, uint64_t outputs, unsigned int activation)
+{
+    return (inputs << 34) + (outputs << 4) + activation;
+}
+
+inline size_t instruction_inputs(uint64_t instruction)
+{
+    return instruction >> 34;
+}
+
+inline size_t instruction_outputs(uint64_t instruction)
+{
+    return (instruction >> 4) & ((1ULL << 30) - 1);
+}
+
+inline unsigned int instruction_activation(uint64_t instruction)
+{
+    return instruction & 0xF;
+}
+
+// Optional first word of an instruction stream: a single config transfer then
+// drives `batch` samples, read `input_stride` floats apart and written
+// `output_stride` floats apart as given by the second word. Without it the first
+// word is the layer count and the stream runs one sample.
+const uint64_t BATCH_HEADER = 1ULL << 63;
+
+inline uint64_t encode_batch_header(uint64_t batch, uint64_t layers)
+{
+    return BATCH_HEADER | (batch << 32) | layers;
+}
+
+inline uint64_t encode_batch_strides(uint64_t input_stride, uint64_t output_stride)
+{
+    return (input_stride << 32) | output_stride;
+}
+
+// Layout of an instruction stream, legacy or batched
+struct InstructionStream
+{
+    size_t layers, batch;
+    size_t input_stride, output_stride; // Floats, 0 for the sample length
+    const uint64_t *instructions;       // One word per layer
+};
+
+inline InstructionStream decode_stream(const uint64_t *words)
+{
+    if (!(words[0] & BATCH_HEADER))
+        return {(size_t)words[0], 1, 0, 0, words + 1};
+    return {(size_t)(words[0] & 0xFFFFFFFF), (size_t)((words[0] >> 32) & 0x7FFFFFFF), (size_t)(words[1] >> 32), (size_t)(words[1] & 0xFFFFFFFF), words + 2};
+}
+
+// Tile a layer for `core` cores into `packed`: for every group of core outputs,
+// the weights of every input node. Appends the hash of every tile to `hashes`.
+inline void tile_weights(cnpy::NpyArray &layer, size_t core, std::vector<float> &packed, std::vector<uint64_t> &hashes)
+{
+    float *data = layer.data<float>();
+    for (size_t offset = 0; offset < layer.shape[1]; offset += core)
+    {
+        size_t range = std::min(std::min(core, layer.shape[1]), layer.shape[1] - offset);
+        size_t begin = packed.size();
+        for (size_t node = 0; node < layer.shape[0]; node++)
+        {
+            for (size_t i = 0; i < range; i++)
+            {
+                packed.push_back(data[node * layer.shape[1] + offset + i]);
+            }
+        }
+        hashes.push_back(xxh64(&packed[begin], (packed.size() - begin) * sizeof(float), 0));
+    }
+}
+
+#endif
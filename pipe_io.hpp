@@ -0,0 +1,84 @@
+#ifndef PIPE_IO_HPP
+#define PIPE_IO_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// read() until `bytes` arrived or the input ended, returns the bytes read
+inline size_t read_full(int fd, void *buffer, size_t bytes)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+        ssize_t n = read(fd, (uint8_t *)buffer + done, bytes - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+inline bool write_full(int fd, const void *buffer, size_t bytes)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+        ssize_t n = write(fd, (const uint8_t *)buffer + done, bytes - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Grow the kernel buffer of a pipe or FIFO so a whole block fits, no-op on
+// files and terminals
+inline void grow_pipe(int fd, size_t bytes)
+{
+#if defined(F_SETPIPE_SZ)
+    fcntl(fd, F_SETPIPE_SZ, (int)bytes);
+#else
+    (void)fd;
+    (void)bytes;
+#endif
+}
+
+// Blocking FIFO handing blocks between the reader, inference and writer threads
+template <typename T>
+class BlockQueue
+{
+public:
+    void push(const T &block)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            blocks.push_back(block);
+        }
+        changed.notify_one();
+    }
+
+    T pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return !blocks.empty(); });
+        T block = blocks.front();
+        blocks.pop_front();
+        return block;
+    }
+
+private:
+    std::deque<T> blocks;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef POWER_MONITOR_HPP
+#define POWER_MONITOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sysfs.hpp"
+
+// Power rail exposed by a Linux hwmon device (INA2xx, PMIC...), either as a
+// power<N>_input file (uW) or as in<N>_input (mV) and curr<N>_input (mA) files
+struct PowerRail
+{
+    std::string name;
+    std::string power_path;
+    std::string voltage_path, current_path;
+};
+
+// Samples every rail under a hwmon root on a background thread and integrates
+// energy per named phase of the run (idle, load, inference...)
+class PowerMonitor
+{
+public:
+    PowerMonitor(const std::string &root, size_t period_ms) : period(period_ms), running(false)
+    {
+        for (const std::string &device : sysfs_list(root))
+        {
+            std::string path = root + "/" + device;
+            std::string chip = sysfs_read(path + "/name");
+            if (chip.empty())
+                chip = device;
+
+            for (const std::string &file : sysfs_list(path))
+            {
+                std::string channel;
+                if (matches(file, "power", channel))
+                {
+                    rails.push_back({chip + "/" + file.substr(0, file.size() - 6), path + "/" + file, "", ""});
+                }
+                else if (matches(file, "curr", channel) && sysfs_read(path + "/power" + channel + "_input").empty() && !sysfs_read(path + "/in" + channel + "_input").empty())
+                {
+                    rails.push_back({chip + "/in" + channel, "", path + "/in" + channel + "_input", path + "/" + file});
+                }
+            }
+        }
+    }
+
+    ~PowerMonitor()
+    {
+        stop();
+    }
+
+    const std::vector<PowerRail> &getRails() const
+    {
+        return rails;
+    }
+
+    // Start sampling, attributing energy to `name` until the next phase()
+    void start(const std::string &name)
+    {
+        phase(name);
+        running = true;
+        sampler = std::thread(&PowerMonitor::loop, this);
+    }
+
+    void phase(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (phases.count(name) == 0)
+        {
+            order.push_back(name);
+            phases[name].energy.assign(rails.size(), 0);
+        }
+        current = name;
+    }
+
+    void stop()
+    {
+        if (running)
+        {
+            running = false;
+            sampler.join();
+        }
+    }
+
+    // Average power and energy of every phase, per inference for `inference_phase`
+    void report(const std::string &inference_phase, size_t inferences)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::string &name : order)
+        {
+            const Phase &p = phases[name];
+            double energy = 0;
+            for (double e : p.energy)
+                energy += e;
+
+            std::cout << "Power [" << name << "]: " << (p.duration > 0 ? energy / p.duration : 0) << " W average, "
+                      << energy << " J over " << p.duration << " s" << std::endl;
+            for (size_t r = 0; r < rails.size(); r++)
+            {
+                std::cout << "\t" << rails[r].name << ": " << (p.duration > 0 ? p.energy[r] / p.duration : 0) << " W" << std::endl;
+            }
+            if (name == inference_phase && inferences > 0)
+            {
+                std::cout << "Energy per inference: " << energy / inferences * 1e6 << " uJ" << std::endl;
+            }
+        }
+    }
+
+private:
+    struct Phase
+    {
+        std::vector<double> energy; // Joules per rail
+        double duration = 0;        // Seconds
+    };
+
+    // "<prefix><channel>_input" attribute names
+    static bool matches(const std::string &file, const std::string &prefix, std::string &channel)
+    {
+        const std::string suffix = "_input";
+        if (file.size() <= prefix.size() + suffix.size() || file.compare(0, prefix.size(), prefix) != 0 ||
+            file.compare(file.size() - suffix.size(), suffix.size(), suffix) != 0)
+            return false;
+        channel = file.substr(prefix.size(), file.size() - prefix.size() - suffix.size());
+        return channel.find_first_not_of("0123456789") == std::string::npos;
+    }
+
+    // Watts drawn by each rail
+    std::vector<double> read() const
+    {
+        std::vector<double> watts;
+        for (const PowerRail &rail : rails)
+        {
+            if (!rail.power_path.empty())
+                watts.push_back(sysfs_read_value(rail.power_path) * 1e-6);
+            else
+                watts.push_back(sysfs_read_value(rail.voltage_path) * sysfs_read_value(rail.current_path) * 1e-6);
+        }
+        return watts;
+    }
+
+    void loop()
+    {
+        std::vector<double> last = read();
+        auto last_time = std::chrono::steady_clock::now();
+        while (running)
+        {
+            std::this_thread::sleep_for(period);
+            std::vector<double> watts = read();
+            auto now = std::chrono::steady_clock::now();
+            double dt = std::chrono::duration<double>(now - last_time).count();
+
+            // Trapezoidal integration, the interval belongs to the current phase
+            std::lock_guard<std::mutex> lock(mutex);
+            Phase &p = phases[current];
+            for (size_t r = 0; r < rails.size(); r++)
+                p.energy[r] += (last[r] + watts[r]) / 2 * dt;
+            p.duration += dt;
+
+            last = watts;
+            last_time = now;
+        }
+    }
+
+    std::vector<PowerRail> rails;
+    std::chrono::milliseconds period;
+    std::atomic<bool> running;
+    std::thread sampler;
+    std::mutex mutex;
+    std::string current;
+    std::vector<std::string> order;
+    std::map<std::string, Phase> phases;
+};
+
+#endif
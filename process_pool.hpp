@@ -0,0 +1,84 @@
+#ifndef PROCESS_POOL_HPP
+#define PROCESS_POOL_HPP
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// Zeroed array in an anonymous shared mapping: forked children write their slot
+// and the parent reads it once they have exited
+template <typename T>
+class SharedArray
+{
+public:
+    SharedArray(size_t count) : count(count)
+    {
+        void *mapping = mmap(NULL, count * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        data = mapping != MAP_FAILED ? (T *)mapping : NULL;
+    }
+
+    ~SharedArray()
+    {
+        if (data != NULL)
+            munmap(data, count * sizeof(T));
+    }
+
+    bool isMapped() const
+    {
+        return data != NULL;
+    }
+
+    void clear()
+    {
+        memset((void *)data, 0, count * sizeof(T));
+    }
+
+    T &operator[](size_t i)
+    {
+        return data[i];
+    }
+
+private:
+    T *data;
+    size_t count;
+};
+
+// Run body(w) for w in [0, workers) in forked processes and wait for them.
+// Children share the parent's mappings copy-on-write, so read-only data such as
+// the dataset is never copied. Only the calling thread exists in a child: body
+// must not use objects served by other threads of the parent (sampling monitors,
+// simulator pools) nor locks they may hold, and builds its own backend instead.
+// Returns false if a worker could not be started or did not exit cleanly.
+inline bool fork_workers(size_t workers, const std::function<void(size_t)> &body)
+{
+    std::vector<pid_t> children;
+    bool succeeded = true;
+    for (size_t w = 0; w < workers; w++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            body(w);
+            _exit(0);
+        }
+        if (pid < 0)
+        {
+            succeeded = false;
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    for (pid_t pid : children)
+    {
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            succeeded = false;
+    }
+    return succeeded;
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// XXH64 (https://github.com/Cyan4973/xxHash), little-endian hosts
+inline uint64_t xxh64(const void *input, size_t length, uint64_t seed)
+{
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL, prime3 = 0x165667B19E3779F9ULL;
+    const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL, prime5 = 0x27D4EB2F165667C5ULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto round = [&](uint64_t acc, uint64_t lane) { return rotl(acc + lane * prime2, 31) * prime1; };
+    auto read64 = [](const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; };
+    auto read32 = [](const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; };
+
+    const uint8_t *p = (const uint8_t *)input;
+    const uint8_t *end = p + length;
+    uint64_t h;
+
+    if (length >= 32)
+    {
+        uint64_t v1 = seed + prime1 + prime2, v2 = seed + prime2, v3 = seed, v4 = seed - prime1;
+        do
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        for (uint64_t v : {v1, v2, v3, v4})
+        {
+            h ^= round(0, v);
+            h = h * prime1 + prime4;
+        }
+    }
+    else
+    {
+        h = seed + prime5;
+    }
+
+    h += length;
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= read32(p) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h ^= *p * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+// LRU cache of output layers keyed by the content of the input row and the model
+// it ran on. Entries remember how long the NPU took so hits can be credited.
+class ResultCache
+{
+public:
+    ResultCache(size_t capacity) : capacity(capacity) {}
+
+    static uint64_t key(const float *input, size_t length, uint64_t model_id)
+    {
+        return xxh64(input, length * sizeof(float), model_id);
+    }
+
+    // Copy the cached outputs of `key` into results, returns false on miss
+    bool lookup(uint64_t key, std::vector<float> &results)
+    {
+        auto it = index.find(key);
+        if (it == index.end())
+        {
+            misses++;
+            return false;
+        }
+
+        entries.splice(entries.begin(), entries, it->second);
+        results.insert(results.end(), it->second->outputs.begin(), it->second->outputs.end());
+        saved_time += it->second->execution_time;
+        hits++;
+        return true;
+    }
+
+    void insert(uint64_t key, const std::vector<float> &outputs, double execution_time)
+    {
+        if (capacity == 0 || index.count(key))
+            return;
+
+        if (entries.size() >= capacity)
+        {
+            memory -= footprint(entries.back());
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+
+        entries.push_front({key, outputs, execution_time});
+        index[key] = entries.begin();
+        memory += footprint(entries.front());
+    }
+
+    size_t getHits() const { return hits; }
+    size_t getMisses() const { return misses; }
+    size_t getSize() const { return entries.size(); }
+
+    // Bytes held by entries, list nodes and index buckets
+    size_t getMemory() const
+    {
+        return memory + index.bucket_count() * sizeof(void *);
+    }
+
+    // NPU time of the inferences answered from the cache (us)
+    double getSavedTime() const { return saved_time; }
+
+private:
+    struct Entry
+    {
+        uint64_t key;
+        std::vector<float> outputs;
+        double execution_time;
+    };
+
+    static size_t footprint(const Entry &entry)
+    {
+        return sizeof(Entry) + 2 * sizeof(void *) + entry.outputs.capacity() * sizeof(float) +
+               sizeof(std::pair<const uint64_t, std::list<Entry>::iterator>) + sizeof(void *);
+    }
+
+    size_t capacity;
+    size_t hits = 0, misses = 0, memory = 0;
+    double saved_time = 0;
+    std::list<Entry> entries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+};
+
+#endif
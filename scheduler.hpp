@@ -0,0 +1,128 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+
+typedef std::chrono::steady_clock scheduler_clock;
+
+// One inference request waiting for the NPU
+struct InferenceRequest
+{
+    size_t id;
+    size_t sample;         // Dataset row to run
+    unsigned int priority; // Class of the request, 0 is the most urgent
+    bool has_deadline;
+    scheduler_clock::time_point deadline;
+    scheduler_clock::time_point arrival;
+};
+
+// Orders pending requests in front of the DMA channels: lowest priority class
+// first, earliest deadline first within a class, then arrival order. A request
+// that has waited for `aging` is promoted by one class per `aging` period, no
+// higher than class 0. Once it reaches the most urgent pending class it is served
+// ahead of it, at most one such request per `aging` period, so bulk work keeps
+// flowing under a steady interactive load without taking its place.
+class RequestScheduler
+{
+public:
+    // aging: waiting time in microseconds per promoted class, 0 disables aging
+    RequestScheduler(size_t aging) : aging(aging) {}
+
+    void submit(const InferenceRequest &request)
+    {
+        pending[request.id] = request;
+        by_deadline[request.priority].insert(deadlineKey(request));
+        by_arrival[request.priority].insert(std::make_pair(request.arrival, request.id));
+    }
+
+    bool empty() const
+    {
+        return pending.empty();
+    }
+
+    size_t size() const
+    {
+        return pending.size();
+    }
+
+    // Remove and return the request that should be served at `now`
+    InferenceRequest next(scheduler_clock::time_point now)
+    {
+        unsigned int most_urgent = 0, aged_class = 0;
+        long aged_effective = 0;
+        bool found = false, aged = false;
+
+        for (auto it = by_arrival.begin(); it != by_arrival.end(); it++)
+        {
+            if (it->second.empty())
+                continue;
+            if (!found)
+            {
+                found = true;
+                most_urgent = it->first;
+                continue;
+            }
+            if (aging == 0)
+                break;
+
+            // The oldest request of a less urgent class rises by its own wait, up
+            // to class 0; ties go to the more urgent class
+            auto waited = std::chrono::duration_cast<std::chrono::microseconds>(now - it->second.begin()->first);
+            long effective = std::max<long>((long)it->first - waited.count() / (long)aging, 0);
+            if (effective <= (long)most_urgent && (!aged || effective < aged_effective))
+            {
+                aged = true;
+                aged_class = it->first;
+                aged_effective = effective;
+            }
+        }
+
+        // An aged request overtakes the urgent class once per aging period and is
+        // taken oldest first, otherwise the urgent class is served earliest
+        // deadline first
+        bool promoted = aged && (promotions == 0 || now - last_promotion >= std::chrono::microseconds(aging));
+        unsigned int best_class = promoted ? aged_class : most_urgent;
+        size_t id = promoted ? by_arrival[best_class].begin()->second : std::get<2>(*by_deadline[best_class].begin());
+        InferenceRequest request = pending[id];
+        if (promoted)
+        {
+            promotions++;
+            last_promotion = now;
+        }
+
+        by_deadline[best_class].erase(deadlineKey(request));
+        by_arrival[best_class].erase(std::make_pair(request.arrival, request.id));
+        pending.erase(id);
+        return request;
+    }
+
+    // Number of requests served ahead of their class because of aging
+    size_t getPromotions() const
+    {
+        return promotions;
+    }
+
+private:
+    typedef std::tuple<scheduler_clock::time_point, scheduler_clock::time_point, size_t> deadline_key;
+
+    static deadline_key deadlineKey(const InferenceRequest &request)
+    {
+        // Requests without deadline sort after every request that has one
+        scheduler_clock::time_point deadline = request.has_deadline ? request.deadline : scheduler_clock::time_point::max();
+        return std::make_tuple(deadline, request.arrival, request.id);
+    }
+
+    size_t aging;
+    size_t promotions = 0;
+    scheduler_clock::time_point last_promotion;
+    std::map<size_t, InferenceRequest> pending;
+    std::map<unsigned int, std::set<deadline_key>> by_deadline;
+    std::map<unsigned int, std::set<std::pair<scheduler_clock::time_point, size_t>>> by_arrival;
+};
+
+#endif
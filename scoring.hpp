@@ -0,0 +1,38 @@
+#ifndef SCORING_HPP
+#define SCORING_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Index of the first largest output
+inline size_t argmax(const float *values, size_t length)
+{
+    size_t best = 0;
+    for (size_t i = 1; i < length; i++)
+    {
+        if (values[i] > values[best])
+            best = i;
+    }
+    return best;
+}
+
+inline size_t argmax(const std::vector<float> &values)
+{
+    return argmax(values.data(), values.size());
+}
+
+// Indices of the k largest outputs, largest first, ties to the lower index
+inline void top_k(const float *values, size_t length, size_t k, std::vector<size_t> &indices)
+{
+    k = std::min(k, length);
+    indices.resize(length);
+    for (size_t i = 0; i < length; i++)
+        indices[i] = i;
+    std::partial_sort(indices.begin(), indices.begin() + k, indices.end(), [values](size_t a, size_t b) {
+        return values[a] > values[b] || (values[a] == values[b] && a < b);
+    });
+    indices.resize(k);
+}
+
+#endif
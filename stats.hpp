@@ -0,0 +1,102 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Nearest-rank percentile (p in [0, 100]) of a set of measurements
+inline double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+    if (rank > 0)
+        rank--;
+    return values[std::min(rank, values.size() - 1)];
+}
+
+inline double mean(const std::vector<double> &values)
+{
+    if (values.empty())
+        return 0;
+    double sum = 0;
+    for (double v : values)
+        sum += v;
+    return sum / values.size();
+}
+
+// Sample standard deviation
+inline double stddev(const std::vector<double> &values)
+{
+    if (values.size() < 2)
+        return 0;
+    double m = mean(values), sum = 0;
+    for (double v : values)
+        sum += (v - m) * (v - m);
+    return std::sqrt(sum / (values.size() - 1));
+}
+
+// Half-width of the 95% confidence interval of the mean (normal approximation)
+inline double confidence95(const std::vector<double> &values)
+{
+    if (values.size() < 2)
+        return 0;
+    return 1.96 * stddev(values) / std::sqrt((double)values.size());
+}
+
+// Latency histogram of nanoseconds, 8 buckets per power of two (at most 12.5%
+// wide). Plain data, so it can live in shared memory and merge by adding buckets.
+struct LatencyHistogram
+{
+    static const size_t sub_buckets = 8;
+    uint64_t counts[64 * sub_buckets];
+
+    void add(uint64_t ns)
+    {
+        counts[bucket(ns)]++;
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t b = 0; b < 64 * sub_buckets; b++)
+            counts[b] += other.counts[b];
+    }
+
+    // Upper bound of the bucket holding the nearest-rank percentile, in ns
+    double percentile(double p) const
+    {
+        uint64_t total = 0, seen = 0;
+        for (uint64_t count : counts)
+            total += count;
+        uint64_t rank = std::max<uint64_t>((uint64_t)std::ceil(p / 100.0 * total), 1);
+        for (size_t b = 0; b < 64 * sub_buckets; b++)
+        {
+            seen += counts[b];
+            if (seen >= rank)
+                return upper(b);
+        }
+        return 0;
+    }
+
+private:
+    static size_t bucket(uint64_t ns)
+    {
+        if (ns < sub_buckets)
+            return ns;
+        size_t octave = 63 - __builtin_clzll(ns); // >= 3
+        return (octave - 2) * sub_buckets + ((ns >> (octave - 3)) & (sub_buckets - 1));
+    }
+
+    static double upper(size_t b)
+    {
+        if (b < sub_buckets)
+            return b + 1;
+        size_t octave = b / sub_buckets + 2;
+        return (double)((sub_buckets + b % sub_buckets + 1) << (octave - 3));
+    }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef STREAM_COPY_HPP
+#define STREAM_COPY_HPP
+
+#include <cstdint>
+#include <cstring>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Copy into memory the CPU only writes (a DMA source window, or a host buffer not
+// read back soon) in 64-byte bursts: NEON quad stores on ARM, non-temporal stores
+// on x86. The destination head up to the first 64-byte boundary and the tail use
+// naturally aligned scalar stores, as device memory faults on unaligned accesses.
+inline void stream_copy(void *destination, const void *source, size_t bytes)
+{
+    uint8_t *dst = (uint8_t *)destination;
+    const uint8_t *src = (const uint8_t *)source;
+
+    // Head
+    for (; bytes > 0 && ((uintptr_t)dst & 3); bytes--)
+        *(volatile uint8_t *)dst++ = *src++;
+    for (; bytes >= 4 && ((uintptr_t)dst & 63); bytes -= 4, dst += 4, src += 4)
+    {
+        uint32_t word;
+        memcpy(&word, src, 4);
+        *(volatile uint32_t *)dst = word;
+    }
+
+    // Bursts
+#if defined(__ARM_NEON)
+    for (; bytes >= 64; bytes -= 64, dst += 64, src += 64)
+    {
+        uint8x16_t a = vld1q_u8(src), b = vld1q_u8(src + 16), c = vld1q_u8(src + 32), d = vld1q_u8(src + 48);
+        vst1q_u8(dst, a);
+        vst1q_u8(dst + 16, b);
+        vst1q_u8(dst + 32, c);
+        vst1q_u8(dst + 48, d);
+    }
+#elif defined(__AVX__)
+    for (; bytes >= 64; bytes -= 64, dst += 64, src += 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)src), b = _mm256_loadu_si256((const __m256i *)(src + 32));
+        _mm256_stream_si256((__m256i *)dst, a);
+        _mm256_stream_si256((__m256i *)(dst + 32), b);
+    }
+    _mm_sfence();
+#elif defined(__SSE2__)
+    for (; bytes >= 64; bytes -= 64, dst += 64, src += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)src), b = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + 32)), d = _mm_loadu_si128((const __m128i *)(src + 48));
+        _mm_stream_si128((__m128i *)dst, a);
+        _mm_stream_si128((__m128i *)(dst + 16), b);
+        _mm_stream_si128((__m128i *)(dst + 32), c);
+        _mm_stream_si128((__m128i *)(dst + 48), d);
+    }
+    _mm_sfence();
+#endif
+
+    // Tail
+    for (; bytes >= 4; bytes -= 4, dst += 4, src += 4)
+    {
+        uint32_t word;
+        memcpy(&word, src, 4);
+        *(volatile uint32_t *)dst = word;
+    }
+    for (; bytes > 0; bytes--)
+        *(volatile uint8_t *)dst++ = *src++;
+}
+
+#endif
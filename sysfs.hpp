@@ -0,0 +1,50 @@
+#ifndef SYSFS_HPP
+#define SYSFS_HPP
+
+#include <dirent.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// First line of a sysfs attribute, empty if it cannot be read
+inline std::string sysfs_read(const std::string &path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+inline double sysfs_read_value(const std::string &path)
+{
+    std::string line = sysfs_read(path);
+    return line.empty() ? 0 : std::stod(line);
+}
+
+inline bool sysfs_write(const std::string &path, const std::string &value)
+{
+    std::ofstream file(path);
+    file << value << std::endl;
+    return file.good();
+}
+
+// Sorted entries of a directory starting with `prefix`, hidden entries excluded
+inline std::vector<std::string> sysfs_list(const std::string &path, const std::string &prefix = "")
+{
+    std::vector<std::string> entries;
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL)
+        return entries;
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name[0] != '.' && name.compare(0, prefix.size(), prefix) == 0)
+            entries.push_back(name);
+    }
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef SYSTEM_MONITOR_HPP
+#define SYSTEM_MONITOR_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sysfs.hpp"
+
+// scaling_governor attributes changed by SystemMonitor::lockGovernor() and the
+// governors they had before
+inline std::vector<std::pair<std::string, std::string>> &saved_governors()
+{
+    static std::vector<std::pair<std::string, std::string>> saved;
+    return saved;
+}
+
+// Write the saved governors back with open() and write() only, so it also runs
+// from a signal handler
+inline void restore_saved_governors()
+{
+    for (const std::pair<std::string, std::string> &governor : saved_governors())
+    {
+        int fd = open(governor.first.c_str(), O_WRONLY | O_TRUNC);
+        if (fd < 0)
+            continue;
+        ssize_t written = write(fd, governor.second.data(), governor.second.size());
+        (void)written;
+        close(fd);
+    }
+}
+
+inline void restore_governors_and_raise(int signal)
+{
+    restore_saved_governors();
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+// Restore the saved governors when the process ends without restoreGovernor():
+// on exit() and on SIGINT or SIGTERM
+inline void restore_governors_on_exit()
+{
+    static bool installed = false;
+    if (installed)
+        return;
+    installed = true;
+    saved_governors(); // Constructed first, so destroyed after the exit handler ran
+    std::atexit(restore_saved_governors);
+    std::signal(SIGINT, restore_governors_and_raise);
+    std::signal(SIGTERM, restore_governors_and_raise);
+}
+
+// cpufreq and thermal zone readings at one point of the run
+struct SystemSnapshot
+{
+    std::vector<std::string> governors;
+    std::vector<long> frequencies;     // Current frequency per CPU (kHz)
+    std::vector<long> max_frequencies; // scaling_max_freq per CPU (kHz)
+    std::vector<double> temperatures;  // Per thermal zone (C)
+};
+
+// Records cpufreq governor/frequency and thermal zone temperatures before, during
+// (sampled on a background thread) and after a run, and detects throttling
+class SystemMonitor
+{
+public:
+    SystemMonitor(const std::string &root, size_t period_ms) : period(period_ms), running(false)
+    {
+        std::string cpu_root = root + "/devices/system/cpu";
+        for (const std::string &cpu : sysfs_list(cpu_root, "cpu"))
+        {
+            if (cpu.find_first_not_of("0123456789", 3) == std::string::npos && !sysfs_read(cpu_root + "/" + cpu + "/cpufreq/scaling_governor").empty())
+            {
+                cpus.push_back(cpu);
+                cpufreq.push_back(cpu_root + "/" + cpu + "/cpufreq");
+                hardware_max.push_back(sysfs_read_value(cpufreq.back() + "/cpuinfo_max_freq"));
+            }
+        }
+
+        std::string thermal_root = root + "/class/thermal";
+        for (const std::string &zone : sysfs_list(thermal_root, "thermal_zone"))
+        {
+            std::string type = sysfs_read(thermal_root + "/" + zone + "/type");
+            zones.push_back(type.empty() ? zone : type);
+            thermal.push_back(thermal_root + "/" + zone + "/temp");
+        }
+    }
+
+    ~SystemMonitor()
+    {
+        stop();
+        restoreGovernor();
+    }
+
+    SystemSnapshot snapshot() const
+    {
+        SystemSnapshot s;
+        for (const std::string &path : cpufreq)
+        {
+            s.governors.push_back(sysfs_read(path + "/scaling_governor"));
+            s.frequencies.push_back(sysfs_read_value(path + "/scaling_cur_freq"));
+            s.max_frequencies.push_back(sysfs_read_value(path + "/scaling_max_freq"));
+        }
+        for (const std::string &path : thermal)
+        {
+            s.temperatures.push_back(sysfs_read_value(path) / 1000.0);
+        }
+        return s;
+    }
+
+    // Switch every CPU to `governor` until restoreGovernor(), or until the process
+    // exits or is interrupted; false if not permitted
+    bool lockGovernor(const std::string &governor)
+    {
+        restore_governors_on_exit();
+        bool locked = true;
+        for (const std::string &path : cpufreq)
+        {
+            saved_governors().push_back(std::make_pair(path + "/scaling_governor", sysfs_read(path + "/scaling_governor") + "\n"));
+            locked = sysfs_write(path + "/scaling_governor", governor) && sysfs_read(path + "/scaling_governor") == governor && locked;
+        }
+        return locked;
+    }
+
+    void restoreGovernor()
+    {
+        restore_saved_governors();
+        saved_governors().clear();
+    }
+
+    void start()
+    {
+        before = snapshot();
+        samples.clear();
+        running = true;
+        sampler = std::thread(&SystemMonitor::loop, this);
+    }
+
+    void stop()
+    {
+        if (running)
+        {
+            running = false;
+            sampler.join();
+            after = snapshot();
+        }
+    }
+
+    // A run is throttled when a CPU ran below the frequency its governor allowed
+    // before the run (performance governor) or when its scaling limit was lowered,
+    // during the run or at its end. Only valid once stop() returned.
+    bool throttled() const
+    {
+        for (const SystemSnapshot &s : samples)
+        {
+            if (throttled(s))
+                return true;
+        }
+        return throttled(after);
+    }
+
+    // Only valid once stop() returned
+    void report() const
+    {
+        print("before", before);
+
+        for (size_t c = 0; c < cpus.size(); c++)
+        {
+            long min = before.frequencies[c], max = min;
+            double sum = 0;
+            for (const SystemSnapshot &s : samples)
+            {
+                min = std::min(min, s.frequencies[c]);
+                max = std::max(max, s.frequencies[c]);
+                sum += s.frequencies[c];
+            }
+            std::cout << "CPU [during] " << cpus[c] << ": min " << min << " kHz, mean " << (samples.empty() ? before.frequencies[c] : (long)(sum / samples.size()))
+                      << " kHz, max " << max << " kHz (hardware max " << hardware_max[c] << " kHz)" << std::endl;
+        }
+        for (size_t z = 0; z < zones.size(); z++)
+        {
+            double max = before.temperatures[z];
+            for (const SystemSnapshot &s : samples)
+                max = std::max(max, s.temperatures[z]);
+            std::cout << "Thermal [during] " << zones[z] << ": max " << max << " C" << std::endl;
+        }
+        print("after", after);
+
+        std::cout << "Throttling: " << (throttled() ? "DETECTED, latency figures are not comparable" : "none") << " (" << samples.size() << " samples)" << std::endl;
+    }
+
+private:
+    bool throttled(const SystemSnapshot &s) const
+    {
+        for (size_t c = 0; c < cpus.size() && c < s.frequencies.size(); c++)
+        {
+            if (s.max_frequencies[c] < before.max_frequencies[c])
+                return true;
+            if (before.governors[c] == "performance" && s.frequencies[c] < before.max_frequencies[c])
+                return true;
+        }
+        return false;
+    }
+
+    void print(const std::string &when, const SystemSnapshot &s) const
+    {
+        for (size_t c = 0; c < cpus.size(); c++)
+        {
+            std::cout << "CPU [" << when << "] " << cpus[c] << ": " << s.governors[c] << ", " << s.frequencies[c] << " kHz (limit " << s.max_frequencies[c] << " kHz)" << std::endl;
+        }
+        for (size_t z = 0; z < zones.size(); z++)
+        {
+            std::cout << "Thermal [" << when << "] " << zones[z] << ": " << s.temperatures[z] << " C" << std::endl;
+        }
+    }
+
+    void loop()
+    {
+        while (running)
+        {
+            std::this_thread::sleep_for(period);
+            SystemSnapshot s = snapshot();
+            std::lock_guard<std::mutex> lock(mutex);
+            samples.push_back(s);
+        }
+    }
+
+    std::vector<std::string> cpus, cpufreq, zones, thermal;
+    std::vector<long> hardware_max;
+    SystemSnapshot before, after;
+    std::vector<SystemSnapshot> samples;
+    std::chrono::milliseconds period;
+    std::atomic<bool> running;
+    std::thread sampler;
+    std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running one parallel loop at a time. The calling
+// thread takes part in every loop as worker 0.
+class ThreadPool
+{
+public:
+    ThreadPool(size_t threads) : generation(0), pending(0), stopping(false)
+    {
+        for (size_t w = 1; w < std::max<size_t>(threads, 1); w++)
+            workers.emplace_back(&ThreadPool::loop, this, w);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    size_t size() const
+    {
+        return workers.size() + 1;
+    }
+
+    // Call task(i) for every i in [0, count), each worker taking a contiguous block
+    void parallelFor(size_t count, const std::function<void(size_t)> &task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->task = &task;
+            this->count = count;
+            pending = workers.size();
+            generation++;
+        }
+        start.notify_all();
+
+        runBlock(0, count, task);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending == 0; });
+    }
+
+private:
+    void runBlock(size_t worker, size_t count, const std::function<void(size_t)> &task)
+    {
+        size_t begin = count * worker / size(), end = count * (worker + 1) / size();
+        for (size_t i = begin; i < end; i++)
+            task(i);
+    }
+
+    void loop(size_t worker)
+    {
+        size_t seen = 0;
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            const std::function<void(size_t)> &task = *this->task;
+            size_t count = this->count;
+            lock.unlock();
+
+            runBlock(worker, count, task);
+
+            lock.lock();
+            if (--pending == 0)
+                done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start, done;
+    const std::function<void(size_t)> *task;
+    size_t count;
+    size_t generation, pending;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef TIMER_HPP
+#define TIMER_HPP
+
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMER_HAVE_COUNTER 1
+#elif defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH >= 7 && defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'A')
+#define TIMER_HAVE_COUNTER 1
+#endif
+#if defined(__arm__) && defined(TIMER_HAVE_COUNTER)
+#include <setjmp.h>
+#include <signal.h>
+#endif
+
+// Free-running CPU counter: ARM generic timer (CNTVCT) or x86 TSC
+inline uint64_t read_counter()
+{
+#if defined(__aarch64__)
+    uint64_t value;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(value)::"memory");
+    return value;
+#elif defined(__arm__) && defined(TIMER_HAVE_COUNTER)
+    uint32_t low, high;
+    asm volatile("isb; mrrc p15, 1, %0, %1, c14" : "=r"(low), "=r"(high)::"memory");
+    return ((uint64_t)high << 32) | low;
+#elif defined(TIMER_HAVE_COUNTER)
+    unsigned int aux;
+    return __rdtscp(&aux);
+#else
+    return 0;
+#endif
+}
+
+// Frequency of read_counter() in Hz, 0 if unknown
+inline double counter_frequency()
+{
+#if defined(__aarch64__)
+    uint64_t frequency;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return frequency;
+#elif defined(__arm__) && defined(TIMER_HAVE_COUNTER)
+    uint32_t frequency;
+    asm volatile("mrc p15, 0, %0, c14, c0, 0" : "=r"(frequency));
+    return frequency;
+#elif defined(TIMER_HAVE_COUNTER)
+    // The TSC has no architectural frequency register, time it against the steady clock
+    auto begin = std::chrono::steady_clock::now();
+    uint64_t start = read_counter();
+    while (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(50))
+        ;
+    uint64_t stop = read_counter();
+    return (stop - start) / std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+#else
+    return 0;
+#endif
+}
+
+#if defined(__arm__) && defined(TIMER_HAVE_COUNTER)
+inline sigjmp_buf &counter_probe()
+{
+    static sigjmp_buf jump;
+    return jump;
+}
+
+inline void counter_probe_fault(int)
+{
+    siglongjmp(counter_probe(), 1);
+}
+#endif
+
+// Whether read_counter() works here with a known frequency. ARMv7-A cores without
+// the generic timer (Cortex-A9) or a kernel keeping it from user space raise
+// SIGILL on the first access, so it is tried once under a handler.
+inline bool counter_available()
+{
+#if defined(__arm__) && defined(TIMER_HAVE_COUNTER)
+    struct sigaction probe, previous;
+    memset(&probe, 0, sizeof(probe));
+    probe.sa_handler = counter_probe_fault;
+    sigemptyset(&probe.sa_mask);
+    sigaction(SIGILL, &probe, &previous);
+    volatile double frequency = 0;
+    if (sigsetjmp(counter_probe(), 1) == 0)
+    {
+        frequency = counter_frequency();
+        read_counter();
+    }
+    else
+    {
+        frequency = 0;
+    }
+    sigaction(SIGILL, &previous, NULL);
+    return frequency > 0;
+#elif defined(TIMER_HAVE_COUNTER)
+    return counter_frequency() > 0;
+#else
+    return false;
+#endif
+}
+
+// Clock used for latency measurements. The overhead of reading the clock is
+// measured at construction and subtracted from every interval.
+class Timer
+{
+public:
+    enum Source
+    {
+        Steady,       // std::chrono::steady_clock
+        MonotonicRaw, // clock_gettime(CLOCK_MONOTONIC_RAW), immune to NTP slewing
+        Counter       // read_counter(), no system call
+    };
+
+    // Parse "steady", "monotonic-raw" or "counter", false if unknown or unavailable
+    static bool parse(const std::string &name, Source &source)
+    {
+        if (name == "steady")
+            source = Steady;
+        else if (name == "monotonic-raw")
+            source = MonotonicRaw;
+        else if (name == "counter" && counter_available())
+            source = Counter;
+        else
+            return false;
+        return true;
+    }
+
+    Timer(Source source = Steady) : source(source), tick(1), overhead(0)
+    {
+        if (source == Counter)
+            tick = 1e9 / counter_frequency();
+        calibrate();
+    }
+
+    // Raw clock value, convert intervals with elapsed()
+    uint64_t now() const
+    {
+        if (source == Counter)
+        {
+            return read_counter();
+        }
+        else if (source == MonotonicRaw)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        }
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Nanoseconds between two now() readings, clock read overhead removed
+    uint64_t elapsed(uint64_t start, uint64_t stop) const
+    {
+        double ns = (stop - start) * tick - overhead;
+        return ns > 0 ? (uint64_t)(ns + 0.5) : 0;
+    }
+
+    std::string getName() const
+    {
+        const char *names[] = {"steady", "monotonic-raw", "counter"};
+        return names[source];
+    }
+
+    // Smallest step the clock was observed to make (ns)
+    double getResolution() const
+    {
+        return resolution;
+    }
+
+    // Median cost of one clock read (ns)
+    double getOverhead() const
+    {
+        return overhead;
+    }
+
+private:
+    void calibrate()
+    {
+        const size_t reads = 10000;
+        std::vector<uint64_t> deltas;
+        uint64_t smallest = UINT64_MAX;
+        for (size_t i = 0; i < reads; i++)
+        {
+            uint64_t start = now();
+            uint64_t stop = now();
+            deltas.push_back(stop - start);
+            if (stop > start)
+                smallest = std::min(smallest, stop - start);
+        }
+        std::nth_element(deltas.begin(), deltas.begin() + reads / 2, deltas.end());
+        overhead = deltas[reads / 2] * tick;
+        resolution = smallest == UINT64_MAX ? 0 : smallest * tick;
+    }
+
+    Source source;
+    double tick;       // Nanoseconds per clock unit
+    double overhead;   // Nanoseconds
+    double resolution; // Nanoseconds
+};
+
+#endif
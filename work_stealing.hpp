@@ -0,0 +1,43 @@
+#ifndef WORK_STEALING_HPP
+#define WORK_STEALING_HPP
+
+#include <mutex>
+
+// Dataset rows shared between the NPU, which takes them from the front, and CPU
+// workers, which steal them from the back. A worker only steals a row when the NPU
+// would need longer to reach it than the worker needs to compute it, so slow CPU
+// workers never delay the end of the run. Nothing is stolen before the NPU cost is
+// known, which keeps workers from draining the queue while the NPU starts up.
+class SampleQueue
+{
+public:
+    SampleQueue(size_t samples) : front(0), back(samples) {}
+
+    bool takeFront(size_t &sample)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (front == back)
+            return false;
+        sample = front++;
+        return true;
+    }
+
+    // Costs are measured per sample in microseconds, 0 while still unknown; a worker
+    // with no cost yet steals one row to measure it
+    bool steal(size_t &sample, double cpu_cost, double npu_cost)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (front == back || npu_cost == 0)
+            return false;
+        if (cpu_cost > 0 && (back - front - 1) * npu_cost < cpu_cost)
+            return false;
+        sample = --back;
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    size_t front, back;
+};
+
+#endif